@@ -0,0 +1,114 @@
+/*
+ * Compare traversal policies on one tree:
+ *
+ *   hk_bench <path> [runs] [--cold] > /dev/null
+ *
+ * Timings go to stderr, the scanner's own output to stdout. --cold drops
+ * the page, dentry and inode caches before every run (root only), which
+ * is where the order of reads shows; warm runs mostly measure cpu.
+ * XXH3 is the digest so that hashing doesn't drown the walk.
+ */
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#include <fmt/core.h>
+
+#include "scan_engine/scan.hpp"
+
+namespace
+{
+
+struct policy
+{
+  const char *name;
+  scan::traversal_order order;
+  bool inode_sorted;
+};
+
+constexpr policy POLICIES[] = {
+  { "dfs", scan::traversal_order::DFS, false },
+  { "bfs", scan::traversal_order::BFS, false },
+  { "dfs+inode", scan::traversal_order::DFS, true },
+  { "bfs+inode", scan::traversal_order::BFS, true },
+};
+
+bool
+drop_caches ()
+{
+  ::sync ();
+  std::ofstream drop ("/proc/sys/vm/drop_caches");
+  return static_cast<bool> (drop << "3\n");
+}
+
+double
+run_once (const std::string &path, const policy &p)
+{
+  const auto start = std::chrono::steady_clock::now ();
+  {
+    scan::scanner s;
+    s.add_path (path);
+    s.set_digests (static_cast<unsigned int> (scan::digest_type::XXH3));
+    s.set_traversal (p.order, p.inode_sorted);
+    s.launch ();
+    s.wait ();
+  }
+  return std::chrono::duration<double, std::milli> (std::chrono::steady_clock::now () - start)
+      .count ();
+}
+
+} // namespace
+
+int
+main (int argc, char *argv[])
+{
+  if (argc < 2)
+    {
+      fmt::print (stderr, "usage: {} <path> [runs] [--cold]\n", argv[0]);
+      return 1;
+    }
+
+  std::string path = argv[1];
+  if (path.back () != '/')
+    {
+      path += '/';
+    }
+  int runs = 3;
+  bool cold = false;
+  for (int i = 2; i < argc; ++i)
+    {
+      if (std::strcmp (argv[i], "--cold") == 0)
+        {
+          cold = true;
+        }
+      else
+        {
+          runs = std::max (1, std::atoi (argv[i]));
+        }
+    }
+
+  fmt::print (stderr, "{:<10} {:>10} {:>10} {:>10}\n", "policy", "min ms", "median ms",
+              "max ms");
+  for (const auto &p : POLICIES)
+    {
+      std::vector<double> times;
+      for (int run = 0; run < runs; ++run)
+        {
+          if (cold && !drop_caches ())
+            {
+              fmt::print (stderr, "can't drop caches, need root\n");
+              return 1;
+            }
+          times.push_back (run_once (path, p));
+        }
+      std::sort (times.begin (), times.end ());
+      fmt::print (stderr, "{:<10} {:>10.1f} {:>10.1f} {:>10.1f}\n", p.name, times.front (),
+                  times[times.size () / 2], times.back ());
+    }
+  return 0;
+}
@@ -0,0 +1,99 @@
+#include "concurrency_tuner.hpp"
+
+#include <algorithm>
+
+namespace scan
+{
+namespace detail
+{
+
+namespace
+{
+
+// throughput changes smaller than this are noise
+constexpr double NOISE = 0.05;
+// mean task time over its best that means the devices are saturated
+constexpr double SATURATED_LATENCY = 2.0;
+// flat intervals before trying another step
+constexpr unsigned int PROBE_EVERY = 4;
+
+}
+
+concurrency_tuner::concurrency_tuner (unsigned int min_threads, unsigned int max_threads,
+                                      unsigned int threads)
+    : min_threads_{ std::max (1u, min_threads) },
+      max_threads_{ std::max (min_threads_, max_threads) },
+      threads_{ std::clamp (threads, min_threads_, max_threads_) }
+{
+}
+
+unsigned int
+concurrency_tuner::update (double throughput, double latency_ns)
+{
+  if (latency_ns > 0 && (best_latency_ == 0 || latency_ns < best_latency_))
+    {
+      best_latency_ = latency_ns;
+    }
+
+  const double last = last_throughput_;
+  last_throughput_ = throughput;
+  if (last <= 0)
+    {
+      // first sample: nothing to compare, try more workers
+      step_ ();
+      return threads_;
+    }
+
+  const double gain = throughput / last;
+  if (gain > 1 + NOISE)
+    {
+      flat_rounds_ = 0;
+    }
+  else if (gain < 1 - NOISE)
+    {
+      flat_rounds_ = 0;
+      direction_ = -direction_;
+    }
+  else if (latency_ns > SATURATED_LATENCY * best_latency_ && threads_ > min_threads_)
+    {
+      flat_rounds_ = 0;
+      direction_ = -1;
+    }
+  else if (++flat_rounds_ < PROBE_EVERY)
+    {
+      return threads_;
+    }
+  else
+    {
+      flat_rounds_ = 0;
+    }
+  step_ ();
+  return threads_;
+}
+
+void
+concurrency_tuner::step_ ()
+{
+  // a quarter of the count: a few workers on a small pool, more on a big one
+  const unsigned int step = std::max (1u, threads_ / 4);
+  if (direction_ > 0)
+    {
+      threads_ = std::min (max_threads_, threads_ + step);
+    }
+  else
+    {
+      threads_ = threads_ > min_threads_ + step ? threads_ - step : min_threads_;
+    }
+  // at a bound, the next step goes the other way
+  if (threads_ == max_threads_)
+    {
+      direction_ = -1;
+    }
+  else if (threads_ == min_threads_)
+    {
+      direction_ = 1;
+    }
+}
+
+}
+}
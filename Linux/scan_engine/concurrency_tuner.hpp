@@ -0,0 +1,41 @@
+#pragma once
+
+namespace scan
+{
+namespace detail
+{
+
+/*
+ * Picks the pool's worker count from what the scan achieves, one sample
+ * per interval: entries listed per second and the mean time of an I/O
+ * task. Hill climbing: a step that raised the throughput is repeated,
+ * one that lowered it is undone. When the throughput stays flat the
+ * count holds, and probes again every few intervals; flat throughput
+ * with tasks taking much longer than they did at best means the devices
+ * are saturated and extra workers only queue there, so the count backs
+ * off.
+ */
+class concurrency_tuner
+{
+public:
+  concurrency_tuner (unsigned int min_threads, unsigned int max_threads, unsigned int threads);
+
+  unsigned int threads () const { return threads_; }
+  // the worker count for the next interval
+  unsigned int update (double throughput, double latency_ns);
+
+private:
+  void step_ ();
+
+private:
+  unsigned int min_threads_;
+  unsigned int max_threads_;
+  unsigned int threads_;
+  int direction_{ 1 };
+  double last_throughput_{};
+  double best_latency_{};
+  unsigned int flat_rounds_{};
+};
+
+}
+}
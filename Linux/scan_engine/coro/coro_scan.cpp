@@ -0,0 +1,231 @@
+#include "scan_engine/scan_private.hpp"
+
+#include <algorithm>
+#include <cerrno>
+
+#include <fmt/core.h>
+
+#include <fcntl.h>
+#include <sys/resource.h>
+
+#include "utils/elf_batch.hpp"
+#include "utils/elf_check.hpp"
+#include "utils/utils.hpp"
+
+#include "reactor.hpp"
+#include "task.hpp"
+
+namespace scan
+{
+namespace detail
+{
+
+namespace
+{
+
+// header checks with their file open at once, at most
+constexpr size_t MAX_OPEN_FILES = 256;
+
+// header checks the fd limit allows next to `dir_fds` open directories
+size_t
+open_files_limit (int dir_fds)
+{
+  struct rlimit nofile{};
+  if (::getrlimit (RLIMIT_NOFILE, &nofile) != 0 || nofile.rlim_cur == RLIM_INFINITY)
+    {
+      return MAX_OPEN_FILES;
+    }
+  // half of what the directories leave: hashing on the pool and the rest
+  // of the process open files too
+  const rlim_t dirs = static_cast<rlim_t> (std::max (dir_fds, 0));
+  const rlim_t left = nofile.rlim_cur > dirs ? (nofile.rlim_cur - dirs) / 2 : 0;
+  return std::clamp<size_t> (static_cast<size_t> (left), 1, MAX_OPEN_FILES);
+}
+
+}
+
+/*
+ * The scan as coroutines: a directory lists itself on the pool, spawns
+ * its subdirectories and then one check per file, all of them in flight
+ * together on the reactor. A check reads like the blocking code (statx,
+ * screen, open, read the header, close) but parks on each step instead
+ * of holding a thread. The directory's records are then hashed and
+ * published on the pool through the same publish_infos_ as the threaded
+ * engine, so the cache, the recorder and continuous mode are shared.
+ */
+class coro_scan
+{
+public:
+  explicit coro_scan (scan_private &scan)
+      : scan_{ scan }, open_dirs_{ reactor_, static_cast<size_t> (scan.max_shared_dir_fds_) },
+        open_files_{ reactor_, open_files_limit (scan.max_shared_dir_fds_) }
+  {
+  }
+
+  void
+  run ()
+  {
+    if (!reactor_.uses_io_uring ())
+      {
+        fmt::print ("io_uring unavailable, coroutines run blocking I/O\n");
+      }
+    for (const auto &dir : scan_.unscanned_dirs_)
+      {
+        if (!scan_.valid_path (dir))
+          {
+            fmt::print ("skip scan path:{}\n", dir);
+            continue;
+          }
+        reactor_.spawn (scan_dir_ (scan_.paths_->add_root (dir)));
+      }
+    reactor_.run ();
+  }
+
+private:
+  task<> scan_dir_ (const path_tree::node *node);
+  task<> check_file_ (int dirfd, const std::string &dir_path, const char *name,
+                      file_info_batch &out_infos, file_info_batch &done_infos);
+
+private:
+  scan_private &scan_;
+  reactor reactor_;
+  async_semaphore open_dirs_;
+  async_semaphore open_files_;
+  // checks holding a slot, parked until another one gives a file back
+  size_t waiting_for_fds_{};
+};
+
+task<>
+coro_scan::scan_dir_ (const path_tree::node *node)
+{
+  if (!scan_.running_)
+    {
+      co_return;
+    }
+  std::string path;
+  path_tree::path_of (node, path);
+  if (!scan_.valid_dir_ (path))
+    {
+      co_return;
+    }
+
+  // the fd stays open while the files are checked relative to it
+  co_await open_dirs_.acquire ();
+  std::unique_ptr<dir_reader> dir;
+  scan_private::dir_entries entries;
+  file_info_batch out_infos{};
+  file_info_batch done_infos{};
+
+  // getdents has no io_uring op, and symlinks resolve with realpath
+  co_await reactor_.offload (*scan_.pool_, scan_.tasks_, [&] {
+    dir = std::make_unique<dir_reader> (path);
+    if (!dir->is_open ())
+      {
+        return;
+      }
+    scan_.list_dir_ (*dir, *scan_.paths_, node, path, entries);
+    std::string sym_path;
+    for (const char *name : entries.symbols)
+      {
+        sym_path = path;
+        sym_path += name;
+        scan_.symbol_reloader (sym_path, out_infos, done_infos);
+      }
+  });
+  if (!dir->is_open ())
+    {
+      fmt::print ("can't open directory {}\n", path);
+      open_dirs_.release ();
+      co_return;
+    }
+  scan_.file_counts_.fetch_add (entries.dirs.size () + entries.files.size ()
+                                + entries.symbols.size ());
+
+  for (const auto *child : entries.dirs)
+    {
+      reactor_.spawn (scan_dir_ (child));
+    }
+
+  wait_group checks;
+  for (const char *name : entries.files)
+    {
+      reactor_.spawn (check_file_ (dir->fd (), path, name, out_infos, done_infos), checks);
+    }
+  co_await checks.wait ();
+
+  if (!out_infos.empty () || !done_infos.empty ())
+    {
+      co_await reactor_.offload (*scan_.pool_, scan_.tasks_, [&] {
+        scan_.publish_infos_ (dir->fd (), path.size (), out_infos, done_infos);
+      });
+    }
+  dir.reset ();
+  open_dirs_.release ();
+  scan_.time_end_ = utils::timestamp_since_epoch<std::chrono::milliseconds> ();
+}
+
+task<>
+coro_scan::check_file_ (int dirfd, const std::string &dir_path, const char *name,
+                        file_info_batch &out_infos, file_info_batch &done_infos)
+{
+  // each check is in flight with the others: a path of its own
+  const std::string path = dir_path + name;
+
+  struct statx stx{};
+  if (co_await reactor_.statx (dirfd, name, AT_SYMLINK_NOFOLLOW | AT_STATX_DONT_SYNC,
+                               scan_.statx_mask_ (false), &stx)
+      < 0)
+    {
+      stx.stx_mask = 0;
+    }
+  file_stamp stamp{};
+  if (!scan_.screen_statx_ (stx, path, stamp, out_infos, done_infos))
+    {
+      co_return;
+    }
+
+  co_await open_files_.acquire ();
+  int elf_type = utils::ELF_PROBE_UNREADABLE;
+  int fd;
+  for (;;)
+    {
+      fd = co_await reactor_.openat (dirfd, name, O_RDONLY | O_CLOEXEC | O_NOCTTY | O_NONBLOCK);
+      // out of fds: wait for a check that isn't waiting itself to close its file
+      if ((fd != -EMFILE && fd != -ENFILE)
+          || open_files_.held () <= waiting_for_fds_ + 1)
+        {
+          break;
+        }
+      ++waiting_for_fds_;
+      co_await open_files_.released ();
+      --waiting_for_fds_;
+    }
+  if (fd >= 0)
+    {
+      utils::T::Ehdr header;
+      const int nread = co_await reactor_.read (fd, &header, sizeof (header), 0);
+      if (nread == static_cast<int> (sizeof (header))
+          && utils::detail::ElfHeaderCheck<>::checkHeader (header))
+        {
+          elf_type = utils::detail::ElfHeaderCheck<>::getType (header);
+        }
+      else if (nread >= 0)
+        {
+          elf_type = utils::ELF_PROBE_INVALID;
+        }
+      co_await reactor_.close (fd);
+    }
+  open_files_.release ();
+
+  scan_.record_elf_ (elf_type, path, stamp, out_infos);
+}
+
+void
+scan_private::run_coroutines_ ()
+{
+  coro_scan (*this).run ();
+  coro_running_ = false;
+}
+
+}
+}
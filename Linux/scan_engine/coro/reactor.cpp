@@ -0,0 +1,371 @@
+#include "reactor.hpp"
+
+#include <cerrno>
+#include <exception>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+namespace scan
+{
+namespace detail
+{
+
+namespace
+{
+
+constexpr unsigned int RING_ENTRIES = 256;
+// user_data of the eventfd poll; io_op addresses are never this small
+constexpr uint64_t WAKE_TAG = 1;
+// the ring takes nothing, not even the eventfd poll: how long to wait on
+// the eventfd before trying again
+constexpr int STUCK_RETRY_MS = 1;
+
+}
+
+// fire and forget: the frame frees itself when the task is over
+struct reactor::detached
+{
+  struct promise_type
+  {
+    detached get_return_object () const noexcept { return {}; }
+    std::suspend_never initial_suspend () const noexcept { return {}; }
+    std::suspend_never final_suspend () const noexcept { return {}; }
+    void return_void () const noexcept {}
+    // scan code doesn't throw, anything reaching here is a bug
+    void unhandled_exception () const noexcept { std::terminate (); }
+  };
+};
+
+void
+wait_group::done (reactor &owner)
+{
+  if (--count_ == 0 && waiter_)
+    {
+      owner.schedule (std::exchange (waiter_, {}));
+    }
+}
+
+void
+async_semaphore::release ()
+{
+  for (auto waiting : release_waiters_)
+    {
+      owner_.schedule (waiting);
+    }
+  release_waiters_.clear ();
+
+  if (waiters_.empty ())
+    {
+      ++count_;
+      return;
+    }
+  // handed over, the count stays taken
+  owner_.schedule (waiters_.front ());
+  waiters_.pop_front ();
+}
+
+reactor::reactor ()
+{
+  wake_fd_ = ::eventfd (0, EFD_CLOEXEC | EFD_NONBLOCK);
+  ring_.init (RING_ENTRIES, { IORING_OP_OPENAT, IORING_OP_STATX, IORING_OP_READ,
+                              IORING_OP_CLOSE, IORING_OP_POLL_ADD });
+}
+
+reactor::~reactor ()
+{
+  if (wake_fd_ >= 0)
+    {
+      ::close (wake_fd_);
+    }
+}
+
+reactor::detached
+reactor::run_detached_ (reactor &owner, task<> work, wait_group *group)
+{
+  co_await std::move (work);
+  if (group != nullptr)
+    {
+      group->done (owner);
+    }
+  --owner.live_;
+}
+
+void
+reactor::spawn (task<> work)
+{
+  ++live_;
+  run_detached_ (*this, std::move (work), nullptr);
+}
+
+void
+reactor::spawn (task<> work, wait_group &group)
+{
+  ++live_;
+  group.add ();
+  run_detached_ (*this, std::move (work), &group);
+}
+
+void
+reactor::run ()
+{
+  while (live_ > 0)
+    {
+      drain_posted_ ();
+      while (!ready_.empty ())
+        {
+          auto next = ready_.front ();
+          ready_.pop_front ();
+          next.resume ();
+        }
+      if (live_ == 0)
+        {
+          break;
+        }
+
+      if (ring_.ready ())
+        {
+          wait_ring_ ();
+        }
+      else
+        {
+          wait_blocking_ ();
+        }
+    }
+}
+
+void
+reactor::post (std::coroutine_handle<> waiting)
+{
+  {
+    std::lock_guard<std::mutex> lock (posted_mutex_);
+    posted_.push_back (waiting);
+  }
+  const uint64_t one = 1;
+  if (::write (wake_fd_, &one, sizeof (one)) < 0)
+    {
+      // todo: log
+    }
+}
+
+void
+reactor::drain_posted_ ()
+{
+  std::lock_guard<std::mutex> lock (posted_mutex_);
+  ready_.insert (ready_.end (), posted_.begin (), posted_.end ());
+  posted_.clear ();
+}
+
+void
+reactor::wait_ring_ ()
+{
+  if (!wake_armed_)
+    {
+      if (io_uring_sqe *sqe = next_sqe_ ())
+        {
+          sqe->opcode = IORING_OP_POLL_ADD;
+          sqe->fd = wake_fd_;
+          sqe->poll32_events = POLLIN;
+          sqe->user_data = WAKE_TAG;
+          wake_armed_ = true;
+        }
+    }
+
+  // something is in flight: an I/O, or pool work that will post; with no
+  // room for the eventfd poll, the ops filling the ring are. Making room
+  // may have reaped some already, then there is no waiting
+  if (ring_.submit (ready_.empty () ? 1 : 0) < 0 && !wake_armed_)
+    {
+      // the ring is stuck: look at the eventfd, then try again
+      wait_blocking_ (STUCK_RETRY_MS);
+    }
+  reap_ ();
+}
+
+unsigned int
+reactor::reap_ ()
+{
+  return ring_.reap ([this] (const io_uring_cqe &cqe) {
+    if (cqe.user_data == WAKE_TAG)
+      {
+        uint64_t count;
+        if (::read (wake_fd_, &count, sizeof (count)) < 0)
+          {
+            // todo: log
+          }
+        wake_armed_ = false;
+        // reaped for a new sqe too, mid loop: what was posted before the
+        // read is taken now, the next post wakes the poll again
+        drain_posted_ ();
+        return;
+      }
+    auto *op = reinterpret_cast<io_op *> (static_cast<uintptr_t> (cqe.user_data));
+    op->result_ = cqe.res;
+    ready_.push_back (op->waiting_);
+  });
+}
+
+io_uring_sqe *
+reactor::next_sqe_ ()
+{
+  // nothing bounds the ops in flight: a big directory's statx fill the ring
+  for (;;)
+    {
+      if (io_uring_sqe *sqe = ring_.get_sqe ())
+        {
+          return sqe;
+        }
+      // the kernel takes the queued sqes, which frees their slots; with its
+      // completion ring full it takes none until some are reaped
+      const int taken = ring_.submit (0);
+      const unsigned int reaped = reap_ ();
+      if (taken <= 0 && reaped == 0)
+        {
+          return nullptr;
+        }
+    }
+}
+
+void
+reactor::wait_blocking_ (int timeout_ms)
+{
+  struct pollfd wake = { wake_fd_, POLLIN, 0 };
+  if (::poll (&wake, 1, timeout_ms) > 0)
+    {
+      uint64_t count;
+      if (::read (wake_fd_, &count, sizeof (count)) < 0)
+        {
+          // todo: log
+        }
+    }
+}
+
+bool
+reactor::io_op::await_ready ()
+{
+  if (owner_.ring_.ready ())
+    {
+      return false;
+    }
+  result_ = run_blocking_ ();
+  return true;
+}
+
+bool
+reactor::io_op::await_suspend (std::coroutine_handle<> waiting)
+{
+  waiting_ = waiting;
+  return owner_.queue_ (*this);
+}
+
+int
+reactor::io_op::run_blocking_ () const
+{
+  int ret = -1;
+  switch (opcode_)
+    {
+    case IORING_OP_OPENAT:
+      ret = ::openat (fd_, static_cast<const char *> (addr_), static_cast<int> (flags_));
+      break;
+    case IORING_OP_STATX:
+      ret = ::statx (fd_, static_cast<const char *> (addr_), static_cast<int> (flags_), len_,
+                     static_cast<struct statx *> (out_));
+      break;
+    case IORING_OP_READ:
+      ret = static_cast<int> (::pread (fd_, out_, len_, static_cast<off_t> (off_)));
+      break;
+    case IORING_OP_CLOSE:
+      ret = ::close (fd_);
+      break;
+    default:
+      errno = EINVAL;
+      break;
+    }
+  return ret < 0 ? -errno : ret;
+}
+
+bool
+reactor::queue_ (io_op &op)
+{
+  io_uring_sqe *sqe = next_sqe_ ();
+  if (sqe == nullptr)
+    {
+      op.result_ = op.run_blocking_ ();
+      return false;
+    }
+
+  sqe->opcode = op.opcode_;
+  sqe->fd = op.fd_;
+  sqe->user_data = reinterpret_cast<uintptr_t> (&op);
+  switch (op.opcode_)
+    {
+    case IORING_OP_OPENAT:
+      sqe->addr = reinterpret_cast<uintptr_t> (op.addr_);
+      sqe->open_flags = op.flags_;
+      break;
+    case IORING_OP_STATX:
+      sqe->addr = reinterpret_cast<uintptr_t> (op.addr_);
+      sqe->len = op.len_;
+      sqe->statx_flags = op.flags_;
+      sqe->off = reinterpret_cast<uintptr_t> (op.out_);
+      break;
+    case IORING_OP_READ:
+      sqe->addr = reinterpret_cast<uintptr_t> (op.out_);
+      sqe->len = op.len_;
+      sqe->off = op.off_;
+      break;
+    default:
+      break;
+    }
+  return true;
+}
+
+reactor::io_op
+reactor::openat (int dirfd, const char *path, int flags)
+{
+  io_op op (*this);
+  op.opcode_ = IORING_OP_OPENAT;
+  op.fd_ = dirfd;
+  op.addr_ = path;
+  op.flags_ = static_cast<uint32_t> (flags);
+  return op;
+}
+
+reactor::io_op
+reactor::statx (int dirfd, const char *path, int flags, unsigned int mask, struct statx *out)
+{
+  io_op op (*this);
+  op.opcode_ = IORING_OP_STATX;
+  op.fd_ = dirfd;
+  op.addr_ = path;
+  op.flags_ = static_cast<uint32_t> (flags);
+  op.len_ = mask;
+  op.out_ = out;
+  return op;
+}
+
+reactor::io_op
+reactor::read (int fd, void *buffer, uint32_t size, uint64_t offset)
+{
+  io_op op (*this);
+  op.opcode_ = IORING_OP_READ;
+  op.fd_ = fd;
+  op.out_ = buffer;
+  op.len_ = size;
+  op.off_ = offset;
+  return op;
+}
+
+reactor::io_op
+reactor::close (int fd)
+{
+  io_op op (*this);
+  op.opcode_ = IORING_OP_CLOSE;
+  op.fd_ = fd;
+  return op;
+}
+
+}
+}
@@ -0,0 +1,233 @@
+#pragma once
+
+#include <coroutine>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+#include <sys/stat.h>
+
+#include "utils/io_uring.hpp"
+#include "utils/thread_pool.hpp"
+
+#include "task.hpp"
+
+namespace scan
+{
+namespace detail
+{
+
+class reactor;
+
+// tasks spawned into a group, awaited together; reactor thread only
+class wait_group
+{
+public:
+  void add () { ++count_; }
+  void done (reactor &owner);
+
+  auto
+  wait ()
+  {
+    struct awaiter
+    {
+      wait_group &group;
+      bool await_ready () const noexcept { return group.count_ == 0; }
+      void await_suspend (std::coroutine_handle<> waiting) noexcept { group.waiter_ = waiting; }
+      void await_resume () const noexcept {}
+    };
+    return awaiter{ *this };
+  }
+
+private:
+  size_t count_{};
+  std::coroutine_handle<> waiter_;
+};
+
+// at most `count` holders at once, the others queue; reactor thread only
+class async_semaphore
+{
+public:
+  async_semaphore (reactor &owner, size_t count)
+      : owner_{ owner }, size_{ count }, count_{ count }
+  {
+  }
+
+  auto
+  acquire ()
+  {
+    struct awaiter
+    {
+      async_semaphore &semaphore;
+      bool
+      await_ready () const noexcept
+      {
+        if (semaphore.count_ == 0)
+          {
+            return false;
+          }
+        --semaphore.count_;
+        return true;
+      }
+      void
+      await_suspend (std::coroutine_handle<> waiting)
+      {
+        semaphore.waiters_.push_back (waiting);
+      }
+      void await_resume () const noexcept {}
+    };
+    return awaiter{ *this };
+  }
+  void release ();
+
+  // parks until the next release (), whoever gets the count
+  auto
+  released ()
+  {
+    struct awaiter
+    {
+      async_semaphore &semaphore;
+      bool await_ready () const noexcept { return false; }
+      void
+      await_suspend (std::coroutine_handle<> waiting)
+      {
+        semaphore.release_waiters_.push_back (waiting);
+      }
+      void await_resume () const noexcept {}
+    };
+    return awaiter{ *this };
+  }
+  size_t held () const { return size_ - count_; }
+
+private:
+  reactor &owner_;
+  size_t size_;
+  size_t count_;
+  std::deque<std::coroutine_handle<>> waiters_;
+  std::deque<std::coroutine_handle<>> release_waiters_;
+};
+
+/*
+ * Single-threaded event loop for the coroutine scan engine. File I/O
+ * (openat, statx, read, close) is queued on an io_uring: a coroutine
+ * awaiting one is parked until its completion comes back, and the ring
+ * carries as many of them at once as coroutines ask for. Blocking or
+ * CPU-bound work (getdents, hashing) is offloaded to a thread pool and
+ * the coroutine resumes back on the loop once it is done; the pool wakes
+ * the loop through an eventfd polled by the ring.
+ *
+ * Without io_uring the same awaitables complete inline with the blocking
+ * syscalls, and the loop waits on the eventfd with poll ().
+ *
+ * Every coroutine runs on the thread calling run (): their state needs
+ * no locking.
+ */
+class reactor
+{
+public:
+  // result of an I/O awaitable, >= 0 or -errno like the syscall
+  class io_op
+  {
+  public:
+    io_op (reactor &owner) : owner_{ owner } {}
+
+    bool await_ready ();
+    bool await_suspend (std::coroutine_handle<> waiting);
+    int await_resume () const noexcept { return result_; }
+
+  private:
+    friend class reactor;
+    int run_blocking_ () const;
+
+  private:
+    reactor &owner_;
+    uint8_t opcode_{};
+    int fd_{ -1 };
+    const void *addr_{};
+    void *out_{};
+    uint32_t len_{};
+    uint32_t flags_{};
+    uint64_t off_{};
+    int result_{};
+    std::coroutine_handle<> waiting_;
+  };
+
+  reactor ();
+  ~reactor ();
+
+  reactor (reactor const &) = delete;
+  reactor &operator= (reactor const &) = delete;
+
+  bool uses_io_uring () const { return ring_.ready (); }
+
+  // start `work` now, run () returns once every spawned task is over
+  void spawn (task<> work);
+  // same, `group` is told when it is over
+  void spawn (task<> work, wait_group &group);
+  void run ();
+
+  // resume `waiting` on the loop; any thread
+  void post (std::coroutine_handle<> waiting);
+  // resume `waiting` on the loop; loop thread
+  void schedule (std::coroutine_handle<> waiting) { ready_.push_back (waiting); }
+
+  io_op openat (int dirfd, const char *path, int flags);
+  io_op statx (int dirfd, const char *path, int flags, unsigned int mask, struct statx *out);
+  io_op read (int fd, void *buffer, uint32_t size, uint64_t offset);
+  io_op close (int fd);
+
+  // run `work` on `pool` in `group`, the awaiting coroutine resumes on
+  // the loop after; `group` mustn't be cancelled while coroutines wait
+  template <typename F>
+  auto
+  offload (utils::thread_pool &pool, utils::task_group &group, F work)
+  {
+    struct awaiter
+    {
+      reactor &owner;
+      utils::thread_pool &pool;
+      utils::task_group &group;
+      F work;
+
+      bool await_ready () const noexcept { return false; }
+      void
+      await_suspend (std::coroutine_handle<> waiting)
+      {
+        pool.push_task (group, [this, waiting] {
+          work ();
+          owner.post (waiting);
+        });
+      }
+      void await_resume () const noexcept {}
+    };
+    return awaiter{ *this, pool, group, std::move (work) };
+  }
+
+private:
+  struct detached;
+  static detached run_detached_ (reactor &owner, task<> work, wait_group *group);
+
+  // false if the ring had no room: `op` ran blocking instead
+  bool queue_ (io_op &op);
+  io_uring_sqe *next_sqe_ ();
+  unsigned int reap_ ();
+  void drain_posted_ ();
+  void wait_ring_ ();
+  void wait_blocking_ (int timeout_ms = -1);
+
+private:
+  utils::io_ring ring_;
+  int wake_fd_{ -1 };
+  bool wake_armed_{};
+  // spawned tasks not over yet
+  size_t live_{};
+  std::deque<std::coroutine_handle<>> ready_;
+
+  std::mutex posted_mutex_;
+  std::vector<std::coroutine_handle<>> posted_;
+};
+
+}
+}
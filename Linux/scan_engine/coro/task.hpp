@@ -0,0 +1,162 @@
+#pragma once
+
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <utility>
+
+namespace scan
+{
+namespace detail
+{
+
+template <typename T> class task;
+
+namespace task_detail
+{
+
+struct promise_base
+{
+  // whoever co_awaits the task, resumed straight from final_suspend
+  std::coroutine_handle<> continuation{ std::noop_coroutine () };
+  std::exception_ptr error;
+
+  struct final_awaiter
+  {
+    bool await_ready () const noexcept { return false; }
+    template <typename P>
+    std::coroutine_handle<>
+    await_suspend (std::coroutine_handle<P> self) noexcept
+    {
+      return self.promise ().continuation;
+    }
+    void await_resume () const noexcept {}
+  };
+
+  std::suspend_always initial_suspend () const noexcept { return {}; }
+  final_awaiter final_suspend () const noexcept { return {}; }
+  void unhandled_exception () { error = std::current_exception (); }
+};
+
+template <typename T>
+struct promise : promise_base
+{
+  std::optional<T> value;
+
+  task<T> get_return_object ();
+  template <typename U>
+  void
+  return_value (U &&result)
+  {
+    value.emplace (std::forward<U> (result));
+  }
+  T
+  result ()
+  {
+    if (error)
+      {
+        std::rethrow_exception (error);
+      }
+    return std::move (*value);
+  }
+};
+
+template <>
+struct promise<void> : promise_base
+{
+  task<void> get_return_object ();
+  void return_void () const noexcept {}
+  void
+  result ()
+  {
+    if (error)
+      {
+        std::rethrow_exception (error);
+      }
+  }
+};
+
+}
+
+/*
+ * Lazy coroutine: nothing runs until it is co_await'ed, or spawned on a
+ * reactor. Awaiting resumes the awaiter directly from the task's end
+ * (symmetric transfer), so long chains don't grow the stack.
+ */
+template <typename T = void>
+class task
+{
+public:
+  using promise_type = task_detail::promise<T>;
+
+  task () = default;
+  explicit task (std::coroutine_handle<promise_type> handle) : handle_{ handle } {}
+  task (task &&other) noexcept : handle_{ std::exchange (other.handle_, {}) } {}
+  task &
+  operator= (task &&other) noexcept
+  {
+    if (this != &other)
+      {
+        reset ();
+        handle_ = std::exchange (other.handle_, {});
+      }
+    return *this;
+  }
+  task (task const &) = delete;
+  task &operator= (task const &) = delete;
+  ~task () { reset (); }
+
+  auto
+  operator co_await () && noexcept
+  {
+    struct awaiter
+    {
+      std::coroutine_handle<promise_type> handle;
+
+      bool await_ready () const noexcept { return !handle || handle.done (); }
+      std::coroutine_handle<>
+      await_suspend (std::coroutine_handle<> awaiting) noexcept
+      {
+        handle.promise ().continuation = awaiting;
+        return handle;
+      }
+      T await_resume () { return handle.promise ().result (); }
+    };
+    return awaiter{ handle_ };
+  }
+
+private:
+  void
+  reset ()
+  {
+    if (handle_)
+      {
+        handle_.destroy ();
+        handle_ = {};
+      }
+  }
+
+private:
+  std::coroutine_handle<promise_type> handle_;
+};
+
+namespace task_detail
+{
+
+template <typename T>
+task<T>
+promise<T>::get_return_object ()
+{
+  return task<T>{ std::coroutine_handle<promise<T>>::from_promise (*this) };
+}
+
+inline task<void>
+promise<void>::get_return_object ()
+{
+  return task<void>{ std::coroutine_handle<promise<void>>::from_promise (*this) };
+}
+
+}
+
+}
+}
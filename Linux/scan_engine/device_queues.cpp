@@ -0,0 +1,198 @@
+#include "device_queues.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+
+#include <sys/sysmacros.h>
+
+#include <fmt/core.h>
+
+namespace scan
+{
+namespace detail
+{
+
+void
+device_queues::push (uint64_t dev, device_task task)
+{
+  device &d = device_of_ (dev);
+  {
+    std::lock_guard<std::mutex> lock (d.mutex);
+    if (d.limit != 0 && d.running >= d.limit)
+      {
+        d.pending.push_back (std::move (task));
+        return;
+      }
+    ++d.running;
+  }
+  pool_.push_task (group_, wrap_ (d, std::move (task)));
+}
+
+void
+device_queues::push_all (uint64_t dev, std::vector<device_task> &tasks)
+{
+  device &d = device_of_ (dev);
+  std::vector<utils::task_function> starting;
+  {
+    std::lock_guard<std::mutex> lock (d.mutex);
+    size_t free_slots = tasks.size ();
+    if (d.limit != 0)
+      {
+        free_slots = d.running >= d.limit ? 0 : std::min<size_t> (free_slots, d.limit - d.running);
+      }
+    d.running += static_cast<unsigned int> (free_slots);
+    // the first ones start, in the order given, the rest wait in it
+    for (size_t i = free_slots; i < tasks.size (); ++i)
+      {
+        d.pending.push_back (std::move (tasks[i]));
+      }
+    tasks.resize (free_slots);
+  }
+
+  starting.reserve (tasks.size ());
+  for (auto &task : tasks)
+    {
+      starting.push_back (wrap_ (d, std::move (task)));
+    }
+  tasks.clear ();
+  pool_.push_tasks (group_, starting.begin (), starting.end ());
+}
+
+unsigned int
+device_queues::detect_limit (uint64_t dev)
+{
+  // a partition has no queue of its own, its disk's is one level up
+  const auto base = fmt::format ("/sys/dev/block/{}:{}/", major (dev), minor (dev));
+  for (const char *queue : { "queue/rotational", "../queue/rotational" })
+    {
+      std::ifstream in (base + queue);
+      int rotational = 0;
+      if (in >> rotational)
+        {
+          return rotational != 0 ? ROTATIONAL_LIMIT : 0;
+        }
+    }
+  // tmpfs, overlay, network...: nothing to seek
+  return 0;
+}
+
+device_queues::device &
+device_queues::device_of_ (uint64_t dev)
+{
+  {
+    std::shared_lock<std::shared_mutex> lock (devices_mutex_);
+    const auto found = devices_.find (dev);
+    if (found != devices_.end ())
+      {
+        return *found->second;
+      }
+  }
+
+  const unsigned int limit = detect_limit (dev);
+  std::unique_lock<std::shared_mutex> lock (devices_mutex_);
+  auto &d = devices_[dev];
+  if (!d)
+    {
+      d = std::make_unique<device> ();
+      d->owner = this;
+      d->limit = limit;
+    }
+  return *d;
+}
+
+void
+device_queues::release_slot ()
+{
+  if (slot *held = running_slot_ ())
+    {
+      held->release ();
+    }
+}
+
+device_queues::slot *&
+device_queues::running_slot_ ()
+{
+  static thread_local slot *running = nullptr;
+  return running;
+}
+
+void
+device_queues::slot::start ()
+{
+  start_ = std::chrono::steady_clock::now ();
+  running_slot_ () = this;
+}
+
+void
+device_queues::slot::release ()
+{
+  if (running_slot_ () == this)
+    {
+      running_slot_ () = nullptr;
+    }
+  if (dev_ == nullptr)
+    {
+      return;
+    }
+  device &dev = *std::exchange (dev_, nullptr);
+  device_queues &queues = *dev.owner;
+  if (start_ != std::chrono::steady_clock::time_point{})
+    {
+      // the time the slot was held, what the tuner weighs
+      const auto took = std::chrono::steady_clock::now () - start_;
+      queues.done_tasks_.fetch_add (1, std::memory_order_relaxed);
+      queues.busy_ns_.fetch_add (
+          std::chrono::duration_cast<std::chrono::nanoseconds> (took).count (),
+          std::memory_order_relaxed);
+    }
+  queues.finish_ (dev);
+}
+
+utils::task_function
+device_queues::wrap_ (device &dev, device_task task)
+{
+  // the slot is part of the wrapped task: handed on even if the task
+  // throws or is dropped by a cancelled group
+  return [held = slot (dev), task = std::move (task)] () mutable {
+    held.start ();
+    task ();
+    held.release ();
+  };
+}
+
+void
+device_queues::finish_ (device &dev)
+{
+  device_task next;
+  std::deque<device_task> dropped;
+  {
+    std::lock_guard<std::mutex> lock (dev.mutex);
+    if (group_.is_cancelled ())
+      {
+        // they would be dropped by the pool one by one
+        dropped.swap (dev.pending);
+      }
+    if (dev.pending.empty ())
+      {
+        --dev.running;
+        return;
+      }
+    if (order_ == utils::task_order::LIFO)
+      {
+        next = std::move (dev.pending.back ());
+        dev.pending.pop_back ();
+      }
+    else
+      {
+        next = std::move (dev.pending.front ());
+        dev.pending.pop_front ();
+      }
+  }
+  // the slot goes on to the next task, still counted as running; pushed
+  // before this task ends, so the pool is never seen empty in between
+  pool_.push_task (group_, wrap_ (dev, std::move (next)));
+}
+
+}
+}
@@ -0,0 +1,127 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "utils/small_task.hpp"
+#include "utils/thread_pool.hpp"
+
+namespace scan
+{
+namespace detail
+{
+
+// small enough that its pool wrapper still fits a task_function in place
+using device_task = utils::small_task<64>;
+
+/*
+ * Admission in front of the pool, one queue per block device (st_dev).
+ * A device only has `limit` tasks on the pool at a time, the rest wait
+ * here in order; a task finishing hands its slot to the next one of the
+ * same device. A spinning disk gets a couple of slots and no seek storm,
+ * flash and non-block filesystems get the whole pool, and several disks
+ * are busy side by side.
+ *
+ * A slot is held for reading the disk only: a task done with its reads
+ * hands it on with release_slot () and computes on, unlimited. A task
+ * dropped by cancelling the group hands its slot on when destroyed.
+ */
+class device_queues
+{
+public:
+  // a rotational disk gets no more than this many tasks at a time
+  static constexpr unsigned int ROTATIONAL_LIMIT = 2;
+
+  // tasks go to `pool` as part of `group`
+  device_queues (utils::thread_pool &pool, utils::task_group &group)
+      : pool_{ pool }, group_{ group }
+  {
+  }
+
+  device_queues (device_queues const &) = delete;
+  device_queues &operator= (device_queues const &) = delete;
+
+  void push (uint64_t dev, device_task task);
+  // all of `tasks`, one lock for the device and one for the pool
+  void push_all (uint64_t dev, std::vector<device_task> &tasks);
+  // which waiting task gets a freed slot, as for the pool's own deques
+  void set_task_order (utils::task_order order) { order_ = order; }
+
+  // from sysfs queue/rotational, 0 for no limit
+  static unsigned int detect_limit (uint64_t dev);
+
+  // the calling task is done with the disk, its slot goes to the next
+  // task of the device now; no-op outside a task pushed here
+  static void release_slot ();
+
+  // tasks run so far and the time they took, all devices
+  struct totals
+  {
+    uint64_t tasks{};
+    uint64_t busy_ns{};
+  };
+  totals get_totals () const
+  {
+    return { done_tasks_.load (std::memory_order_relaxed),
+             busy_ns_.load (std::memory_order_relaxed) };
+  }
+
+private:
+  struct device
+  {
+    device_queues *owner{};
+    std::mutex mutex;
+    std::deque<device_task> pending;
+    unsigned int running{};
+    unsigned int limit{};
+  };
+
+  // a wrapped task's hold on its device slot, given back once: when the
+  // task releases it, returns, or is destroyed without running
+  class slot
+  {
+  public:
+    explicit slot (device &dev) : dev_{ &dev } {}
+    slot (slot &&other) noexcept
+        : dev_{ std::exchange (other.dev_, nullptr) }, start_{ other.start_ }
+    {
+    }
+    slot (slot const &) = delete;
+    slot &operator= (slot const &) = delete;
+    ~slot () { release (); }
+
+    void start ();
+    void release ();
+
+  private:
+    device *dev_;
+    std::chrono::steady_clock::time_point start_{};
+  };
+
+  // the slot of the task running on this thread, if any
+  static slot *&running_slot_ ();
+
+  device &device_of_ (uint64_t dev);
+  utils::task_function wrap_ (device &dev, device_task task);
+  void finish_ (device &dev);
+
+private:
+  utils::thread_pool &pool_;
+  utils::task_group &group_;
+  std::atomic<utils::task_order> order_{ utils::task_order::LIFO };
+  std::atomic<uint64_t> done_tasks_{};
+  std::atomic<uint64_t> busy_ns_{};
+  std::shared_mutex devices_mutex_;
+  std::unordered_map<uint64_t, std::unique_ptr<device>> devices_;
+};
+
+}
+}
@@ -0,0 +1,231 @@
+#include "fs_watcher.hpp"
+
+#include <cerrno>
+#include <climits>
+#include <cstdio>
+#include <cstring>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/fanotify.h>
+#include <sys/statfs.h>
+
+namespace scan
+{
+namespace detail
+{
+
+// a write shows up once, when the writer is done: hashing a file
+// still being written on every FAN_MODIFY would be wasted work
+const uint64_t fs_watcher::EVENTS = FAN_CREATE | FAN_CLOSE_WRITE | FAN_ATTRIB
+                                    | FAN_MOVED_FROM | FAN_MOVED_TO | FAN_DELETE
+                                    | FAN_ONDIR;
+
+fs_watcher::~fs_watcher ()
+{
+  for (const auto &mount : mounts_)
+    {
+      ::close (mount.fd);
+    }
+  if (wake_fd_ >= 0)
+    {
+      ::close (wake_fd_);
+    }
+  if (fan_fd_ >= 0)
+    {
+      ::close (fan_fd_);
+    }
+}
+
+bool
+fs_watcher::open ()
+{
+  fan_fd_ = ::fanotify_init (FAN_CLASS_NOTIF | FAN_CLOEXEC | FAN_NONBLOCK
+                                 | FAN_REPORT_DFID_NAME,
+                             O_RDONLY | O_LARGEFILE | O_CLOEXEC);
+  if (fan_fd_ < 0)
+    {
+      return false;
+    }
+
+  wake_fd_ = ::eventfd (0, EFD_CLOEXEC | EFD_NONBLOCK);
+  return wake_fd_ >= 0;
+}
+
+bool
+fs_watcher::add_filesystem (const std::string &path)
+{
+  const int fd = ::open (path.c_str (), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (fd < 0)
+    {
+      return false;
+    }
+
+  struct statfs fs{};
+  if (::fstatfs (fd, &fs) != 0)
+    {
+      ::close (fd);
+      return false;
+    }
+
+  mount_ref mount{};
+  static_assert (sizeof (mount.fsid) == sizeof (fs.f_fsid), "fsid layout");
+  std::memcpy (mount.fsid, &fs.f_fsid, sizeof (mount.fsid));
+  mount.fd = fd;
+
+  for (const auto &known : mounts_)
+    {
+      if (std::memcmp (known.fsid, mount.fsid, sizeof (mount.fsid)) == 0)
+        {
+          // already watched through another path
+          ::close (fd);
+          return true;
+        }
+    }
+
+  if (::fanotify_mark (fan_fd_, FAN_MARK_ADD | FAN_MARK_FILESYSTEM, EVENTS, fd, nullptr) != 0)
+    {
+      ::close (fd);
+      return false;
+    }
+  mounts_.push_back (mount);
+  return true;
+}
+
+bool
+fs_watcher::wait_events (std::vector<fs_event> &events, int timeout_ms)
+{
+  alignas (fanotify_event_metadata) char buffer[16 * 1024];
+
+  struct pollfd fds[2] = { { fan_fd_, POLLIN, 0 }, { wake_fd_, POLLIN, 0 } };
+  while (events.empty ())
+    {
+      const int ready = ::poll (fds, 2, timeout_ms);
+      if (ready < 0)
+        {
+          if (errno == EINTR)
+            {
+              continue;
+            }
+          return false;
+        }
+      if (ready == 0)
+        {
+          return true;
+        }
+      if (fds[1].revents != 0)
+        {
+          return false;
+        }
+
+      const ssize_t len = ::read (fan_fd_, buffer, sizeof (buffer));
+      if (len < 0)
+        {
+          if (errno == EAGAIN || errno == EINTR)
+            {
+              continue;
+            }
+          return false;
+        }
+
+      auto left = len;
+      for (auto *meta = reinterpret_cast<const fanotify_event_metadata *> (buffer);
+           FAN_EVENT_OK (meta, left); meta = FAN_EVENT_NEXT (meta, left))
+        {
+          if (meta->vers != FANOTIFY_METADATA_VERSION)
+            {
+              return false;
+            }
+          if (meta->mask & FAN_Q_OVERFLOW)
+            {
+              events.push_back ({ std::string{}, meta->mask });
+              continue;
+            }
+
+          // info records follow the metadata up to event_len
+          const char *info = reinterpret_cast<const char *> (meta) + meta->metadata_len;
+          const char *end = reinterpret_cast<const char *> (meta) + meta->event_len;
+          while (info + sizeof (fanotify_event_info_header) <= end)
+            {
+              const auto *fid = reinterpret_cast<const fanotify_event_info_fid *> (info);
+              if (fid->hdr.len == 0)
+                {
+                  break;
+                }
+              if (fid->hdr.info_type == FAN_EVENT_INFO_TYPE_DFID_NAME
+                  || fid->hdr.info_type == FAN_EVENT_INFO_TYPE_DFID)
+                {
+                  std::string path = resolve_ (&fid->fsid, fid->handle);
+                  if (!path.empty ())
+                    {
+                      if (fid->hdr.info_type == FAN_EVENT_INFO_TYPE_DFID_NAME)
+                        {
+                          // the name is stored right after the handle
+                          const auto *handle
+                              = reinterpret_cast<const struct file_handle *> (fid->handle);
+                          const char *name = reinterpret_cast<const char *> (
+                              handle->f_handle + handle->handle_bytes);
+                          if (std::strcmp (name, ".") != 0)
+                            {
+                              path += (path.back () == '/' ? "" : "/");
+                              path += name;
+                            }
+                        }
+                      events.push_back ({ std::move (path), meta->mask });
+                    }
+                  break;
+                }
+              info += fid->hdr.len;
+            }
+        }
+    }
+  return true;
+}
+
+void
+fs_watcher::interrupt ()
+{
+  const uint64_t one = 1;
+  if (wake_fd_ >= 0 && ::write (wake_fd_, &one, sizeof (one)) < 0)
+    {
+      // todo: log
+    }
+}
+
+std::string
+fs_watcher::resolve_ (const void *fsid, const void *handle) const
+{
+  for (const auto &mount : mounts_)
+    {
+      if (std::memcmp (mount.fsid, fsid, sizeof (mount.fsid)) != 0)
+        {
+          continue;
+        }
+
+      // fails with ESTALE once the directory itself is gone
+      const int fd = ::open_by_handle_at (
+          mount.fd, reinterpret_cast<struct file_handle *> (const_cast<void *> (handle)),
+          O_PATH | O_CLOEXEC);
+      if (fd < 0)
+        {
+          return {};
+        }
+
+      char link[32];
+      char path[PATH_MAX];
+      std::snprintf (link, sizeof (link), "/proc/self/fd/%d", fd);
+      const ssize_t len = ::readlink (link, path, sizeof (path) - 1);
+      ::close (fd);
+      if (len <= 0)
+        {
+          return {};
+        }
+      return std::string (path, static_cast<size_t> (len));
+    }
+  return {};
+}
+
+}
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace scan
+{
+namespace detail
+{
+
+struct fs_event
+{
+  // absolute, empty for FAN_Q_OVERFLOW: events were lost
+  std::string path;
+  // FAN_* bits, FAN_ONDIR when `path` is a directory
+  uint64_t mask{};
+};
+
+/*
+ * Filesystem-wide change feed over fanotify. Events carry the parent
+ * directory as a file handle plus the entry name (FAN_REPORT_DFID_NAME),
+ * resolved back to a path with open_by_handle_at. Needs CAP_SYS_ADMIN and
+ * CAP_DAC_READ_SEARCH, linux 5.9 or later.
+ */
+class fs_watcher
+{
+public:
+  // entries created, written and closed, chmod'ed, moved or deleted
+  static const uint64_t EVENTS;
+
+  fs_watcher () = default;
+  ~fs_watcher ();
+
+  fs_watcher (fs_watcher const &) = delete;
+  fs_watcher &operator= (fs_watcher const &) = delete;
+
+  // false if fanotify isn't available to us
+  bool open ();
+  // watch the whole filesystem `path` lives on, once per filesystem
+  bool add_filesystem (const std::string &path);
+
+  // block until some events are read, or `timeout_ms` passed with none
+  // (-1: no timeout); false once interrupted or broken
+  bool wait_events (std::vector<fs_event> &events, int timeout_ms = -1);
+  // wake wait_events for good, from any thread
+  void interrupt ();
+
+private:
+  struct mount_ref
+  {
+    uint32_t fsid[2];
+    int fd;
+  };
+
+  std::string resolve_ (const void *fsid, const void *handle) const;
+
+private:
+  int fan_fd_{ -1 };
+  int wake_fd_{ -1 };
+  // one fd per watched filesystem, for open_by_handle_at
+  std::vector<mount_ref> mounts_;
+};
+
+}
+}
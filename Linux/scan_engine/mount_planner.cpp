@@ -0,0 +1,234 @@
+#include "mount_planner.hpp"
+
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+
+#include "utils/utils.hpp"
+
+namespace scan
+{
+namespace detail
+{
+
+namespace
+{
+
+// mountinfo escapes space, tab, newline and backslash as \ooo
+std::string
+unescape (const std::string &field)
+{
+  std::string out;
+  out.reserve (field.size ());
+  for (size_t i = 0; i < field.size (); ++i)
+    {
+      if (field[i] == '\\' && i + 3 < field.size ())
+        {
+          const std::string octal = field.substr (i + 1, 3);
+          if (octal.find_first_not_of ("01234567") == std::string::npos)
+            {
+              out += static_cast<char> (std::stoi (octal, nullptr, 8));
+              i += 3;
+              continue;
+            }
+        }
+      out += field[i];
+    }
+  return out;
+}
+
+std::string
+as_dir (std::string path)
+{
+  if (path.empty () || path.back () != '/')
+    {
+      path += '/';
+    }
+  return path;
+}
+
+// same mount or nested below it
+bool
+within (const std::string &dir, const std::string &ancestor)
+{
+  return utils::hasPrefix (dir, ancestor);
+}
+
+} // namespace
+
+mount_planner::mount_planner ()
+    : excluded_fstypes_{
+        // kernel interfaces, not files
+        "proc", "sysfs", "cgroup", "cgroup2", "devtmpfs", "devpts", "mqueue",
+        "debugfs", "tracefs", "securityfs", "pstore", "bpf", "configfs", "fusectl",
+        "binfmt_misc", "autofs", "efivarfs", "selinuxfs", "rpc_pipefs", "nsfs",
+        "hugetlbfs",
+        // gone at reboot
+        "tmpfs", "ramfs",
+        // remote, slow and someone else's to scan
+        "nfs", "nfs4", "cifs", "smb3", "smbfs", "ceph", "glusterfs", "9p", "afs",
+      }
+{
+}
+
+bool
+mount_planner::load (const std::string &mountinfo_path)
+{
+  loaded_ = false;
+  mounts_.clear ();
+  decisions_.clear ();
+
+  std::ifstream in (mountinfo_path);
+  if (!in)
+    {
+      return false;
+    }
+
+  // id parent major:minor root mount_point options [optional...] - fstype source super
+  std::string line;
+  while (std::getline (in, line))
+    {
+      std::istringstream fields (line);
+      mount_info mount;
+      std::string dev, root, mount_point, options, field;
+      if (!(fields >> mount.id >> mount.parent_id >> dev >> root >> mount_point >> options))
+        {
+          continue;
+        }
+      while (fields >> field && field != "-")
+        {
+        }
+      if (field != "-" || !(fields >> mount.fstype))
+        {
+          continue;
+        }
+
+      unsigned int major = 0, minor = 0;
+      if (std::sscanf (dev.c_str (), "%u:%u", &major, &minor) != 2)
+        {
+          continue;
+        }
+      mount.dev = static_cast<uint64_t> (makedev (major, minor));
+      mount.root = as_dir (unescape (root));
+      mount.mount_point = as_dir (unescape (mount_point));
+      mounts_.push_back (std::move (mount));
+    }
+
+  loaded_ = !mounts_.empty ();
+  return loaded_;
+}
+
+void
+mount_planner::plan (const std::vector<std::string> &roots)
+{
+  decisions_.clear ();
+
+  std::unordered_set<uint64_t> root_devs;
+  std::vector<std::string> root_dirs;
+  for (const auto &root : roots)
+    {
+      struct stat st{};
+      if (::stat (root.c_str (), &st) == 0)
+        {
+          root_devs.insert (static_cast<uint64_t> (st.st_dev));
+        }
+      root_dirs.push_back (as_dir (root));
+    }
+
+  const auto scanned = [&root_dirs] (const std::string &dir) {
+    for (const auto &root : root_dirs)
+      {
+        if (within (dir, root))
+          {
+            return true;
+          }
+      }
+    return false;
+  };
+  const auto in_scope = [&root_dirs] (const std::string &dir) {
+    for (const auto &root : root_dirs)
+      {
+        if (within (dir, root) || within (root, dir))
+          {
+            return true;
+          }
+      }
+    return false;
+  };
+
+  // mounts walked so far, in mount order: the first mount of some
+  // content is the one kept, later binds of it are duplicates
+  std::vector<const mount_info *> walked;
+  for (const auto &mount : mounts_)
+    {
+      bool skip = excluded_fstype_ (mount.fstype)
+                  || (one_filesystem_ && root_devs.count (mount.dev) == 0);
+
+      if (!skip)
+        {
+          for (const auto *earlier : walked)
+            {
+              if (earlier->dev != mount.dev || !within (mount.root, earlier->root))
+                {
+                  continue;
+                }
+              // only a duplicate if the scan gets there the other way
+              const auto original
+                  = earlier->mount_point + mount.root.substr (earlier->root.size ());
+              if (scanned (original) && original != mount.mount_point)
+                {
+                  skip = true;
+                  break;
+                }
+            }
+        }
+
+      if (!skip && in_scope (mount.mount_point))
+        {
+          walked.push_back (&mount);
+        }
+      decisions_[mount.mount_point] = skip;
+    }
+}
+
+bool
+mount_planner::skip_dir (const std::string &dir) const
+{
+  const auto found = decisions_.find (dir);
+  return found != decisions_.end () && found->second;
+}
+
+bool
+mount_planner::skip_path (const std::string &path) const
+{
+  // nearest mount point at or above `path`
+  std::string dir = as_dir (path);
+  while (!dir.empty ())
+    {
+      const auto found = decisions_.find (dir);
+      if (found != decisions_.end ())
+        {
+          return found->second;
+        }
+      const auto slash = dir.find_last_of ('/', dir.size () - 2);
+      if (dir.size () < 2 || slash == std::string::npos)
+        {
+          break;
+        }
+      dir.erase (slash + 1);
+    }
+  return false;
+}
+
+bool
+mount_planner::excluded_fstype_ (const std::string &fstype) const
+{
+  // fuse, fuseblk and every fuse.<helper>: sshfs, rclone, gvfs...
+  return excluded_fstypes_.count (fstype) != 0 || utils::hasPrefix (fstype, "fuse");
+}
+
+}
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace scan
+{
+namespace detail
+{
+
+struct mount_info
+{
+  int id{};
+  int parent_id{};
+  uint64_t dev{};
+  // path inside the filesystem that is mounted, "/" unless a bind mount
+  std::string root;
+  // with a trailing '/', like the scanner's directory paths
+  std::string mount_point;
+  std::string fstype;
+};
+
+/*
+ * Decides which mounts a scan walks into, from /proc/self/mountinfo read
+ * once per launch. A mount is skipped when its filesystem type is
+ * excluded (pseudo, volatile or network filesystems), when it shows
+ * content already reachable through an earlier mount of the same device
+ * (bind mounts), or, in one-filesystem mode, when it isn't on the device
+ * of a scan root.
+ *
+ * Only mount points carry a decision: a directory that isn't one is on
+ * its parent's filesystem, which was already let through. skip_dir() is
+ * then a single hash lookup.
+ */
+class mount_planner
+{
+public:
+  mount_planner ();
+
+  // false if mountinfo can't be read: nothing is skipped then
+  bool load (const std::string &mountinfo_path = "/proc/self/mountinfo");
+  bool loaded () const { return loaded_; }
+
+  void set_one_filesystem (bool one_filesystem) { one_filesystem_ = one_filesystem; }
+  void exclude_fstype (const std::string &fstype) { excluded_fstypes_.insert (fstype); }
+
+  // decide every mount against the scan roots, after load ()
+  void plan (const std::vector<std::string> &roots);
+
+  // `dir` ends with '/'; answers for mount points only, O(1)
+  bool skip_dir (const std::string &dir) const;
+  // any path: decided by the mount it lives on
+  bool skip_path (const std::string &path) const;
+
+private:
+  bool excluded_fstype_ (const std::string &fstype) const;
+
+private:
+  bool loaded_{};
+  bool one_filesystem_{};
+  std::unordered_set<std::string> excluded_fstypes_;
+  std::vector<mount_info> mounts_;
+  // mount point -> skip it or not, the last mount wins on a stacked point
+  std::unordered_map<std::string, bool> decisions_;
+};
+
+}
+}
@@ -0,0 +1,128 @@
+#include "path_tree.hpp"
+
+#include <array>
+#include <atomic>
+#include <algorithm>
+#include <cstring>
+#include <new>
+
+namespace scan
+{
+namespace detail
+{
+
+namespace
+{
+
+constexpr size_t BLOCK_SIZE = 64 * 1024;
+// trees a thread allocates from at once without giving up a block
+constexpr size_t CURSORS_PER_THREAD = 4;
+
+std::atomic<uint64_t> next_tree_id{ 1 };
+
+}
+
+// where a thread is in its current block of one tree
+struct path_tree::cursor
+{
+  uint64_t tree{};
+  char *next{};
+  char *end{};
+};
+
+path_tree::path_tree () : id_{ next_tree_id.fetch_add (1) } {}
+
+path_tree::~path_tree () = default;
+
+const path_tree::node *
+path_tree::add_root (std::string_view path)
+{
+  node *root = allocate_ (path.size ());
+  root->parent = nullptr;
+  root->size = static_cast<uint32_t> (path.size ());
+  char *name = const_cast<char *> (root->name ());
+  std::memcpy (name, path.data (), path.size ());
+  name[path.size ()] = '\0';
+  return root;
+}
+
+const path_tree::node *
+path_tree::add (const node *parent, std::string_view name)
+{
+  node *dir = allocate_ (name.size ());
+  dir->parent = parent;
+  dir->size = static_cast<uint32_t> (name.size ());
+  char *stored = const_cast<char *> (dir->name ());
+  std::memcpy (stored, name.data (), name.size ());
+  stored[name.size ()] = '\0';
+  return dir;
+}
+
+void
+path_tree::path_of (const node *dir, std::string &out)
+{
+  size_t size = 0;
+  const node *root = dir;
+  for (; root->parent != nullptr; root = root->parent)
+    {
+      size += root->size + 1;
+    }
+  size += root->size;
+
+  // filled from the end; the buffer keeps its capacity from call to call
+  out.resize (size);
+  for (const node *n = dir; n->parent != nullptr; n = n->parent)
+    {
+      out[--size] = '/';
+      size -= n->size;
+      std::memcpy (&out[size], n->name (), n->size);
+    }
+  std::memcpy (&out[0], root->name (), root->size);
+}
+
+path_tree::node *
+path_tree::allocate_ (size_t name_size)
+{
+  constexpr size_t align = alignof (node);
+  const size_t size = (sizeof (node) + name_size + 1 + align - 1) & ~(align - 1);
+
+  thread_local std::array<cursor, CURSORS_PER_THREAD> cursors{};
+  thread_local size_t next_victim = 0;
+  cursor *mine = nullptr;
+  for (auto &c : cursors)
+    {
+      if (c.tree == id_)
+        {
+          mine = &c;
+          break;
+        }
+    }
+  if (mine == nullptr)
+    {
+      // a thread working for more trees than that leaves block ends unused
+      mine = &cursors[next_victim++ % CURSORS_PER_THREAD];
+      *mine = { id_, nullptr, nullptr };
+    }
+
+  if (static_cast<size_t> (mine->end - mine->next) < size)
+    {
+      const size_t block = std::max (BLOCK_SIZE, size);
+      mine->next = new_block_ (block);
+      mine->end = mine->next + block;
+    }
+  node *allocated = ::new (static_cast<void *> (mine->next)) node{};
+  mine->next += size;
+  return allocated;
+}
+
+char *
+path_tree::new_block_ (size_t size)
+{
+  std::lock_guard<std::mutex> lock (blocks_mutex_);
+  // not zeroed, every byte is written before it is read
+  blocks_.emplace_back (new char[size]);
+  return blocks_.back ().get ();
+}
+
+}
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace scan
+{
+namespace detail
+{
+
+/*
+ * The directories of a scan, each stored once as its parent and its own
+ * name. Nodes are bump-allocated with their name from arena blocks that
+ * each thread takes for itself, so interning a directory takes no lock
+ * and no allocation but once per block, and a pool task carries a node
+ * pointer instead of a path. Full paths are only put together when
+ * needed, into a buffer the caller reuses.
+ *
+ * Nodes live as long as the tree and never move, so a task holding a
+ * node keeps its tree alive; adding is thread-safe, reading a node
+ * handed over through the pool needs no locking.
+ */
+class path_tree
+{
+public:
+  struct node
+  {
+    const node *parent;
+    uint32_t size;
+
+    // NUL-terminated, follows the node in its block
+    const char *name () const { return reinterpret_cast<const char *> (this + 1); }
+  };
+
+  path_tree ();
+  ~path_tree ();
+
+  path_tree (path_tree const &) = delete;
+  path_tree &operator= (path_tree const &) = delete;
+
+  // a scan root, spelled as given; its children are `root + name + '/'`
+  const node *add_root (std::string_view path);
+  // a subdirectory of `parent`
+  const node *add (const node *parent, std::string_view name);
+
+  // `root` then every name down to `dir`, each followed by '/'
+  static void path_of (const node *dir, std::string &out);
+
+private:
+  struct cursor;
+  node *allocate_ (size_t name_size);
+  char *new_block_ (size_t size);
+
+private:
+  // tells trees apart in the threads' cursors, addresses get reused
+  const uint64_t id_;
+  std::mutex blocks_mutex_;
+  std::vector<std::unique_ptr<char[]>> blocks_;
+};
+
+}
+}
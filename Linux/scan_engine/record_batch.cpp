@@ -0,0 +1,95 @@
+#include "record_batch.hpp"
+
+#include <cstring>
+
+#include "utils/md5.hpp"
+#include "utils/utils.hpp"
+
+namespace scan
+{
+namespace detail
+{
+
+static_assert (utils::toUType (file_type::REMOVED) <= UINT8_MAX,
+               "record_batch keeps a file_type in a byte");
+static_assert (utils::ALL_DIGESTS <= UINT8_MAX, "record_batch keeps a digest_mask in a byte");
+
+record_batch::record_batch (utils::digest_mask digests) : digests_{ digests & utils::ALL_DIGESTS }
+{
+  for (size_t algo = 0; algo < utils::DIGEST_ALGO_COUNT; ++algo)
+    {
+      if (digests_ & (1u << algo))
+        {
+          offsets_[algo] = stride_;
+          stride_ += utils::digest_size (static_cast<utils::digest_algo> (algo));
+        }
+    }
+}
+
+void
+record_batch::reserve (size_t records, size_t path_bytes)
+{
+  paths_.reserve (path_bytes);
+  path_ends_.reserve (records);
+  types_.reserve (records);
+  present_.reserve (records);
+  digests_data_.reserve (records * stride_);
+}
+
+void
+record_batch::clear ()
+{
+  paths_.clear ();
+  path_ends_.clear ();
+  types_.clear ();
+  present_.clear ();
+  digests_data_.clear ();
+}
+
+void
+record_batch::push (std::string_view path, file_type type, const utils::digest_set &digests)
+{
+  paths_.append (path);
+  path_ends_.push_back (static_cast<uint32_t> (paths_.size ()));
+  types_.push_back (static_cast<uint8_t> (type));
+
+  const size_t at = digests_data_.size ();
+  digests_data_.resize (at + stride_);
+  const utils::digest_mask present = digests.present () & digests_;
+  for (size_t algo = 0; algo < utils::DIGEST_ALGO_COUNT; ++algo)
+    {
+      const auto which = static_cast<utils::digest_algo> (algo);
+      if (present & (1u << algo))
+        {
+          std::memcpy (&digests_data_[at + offsets_[algo]], digests.get (which),
+                       utils::digest_size (which));
+        }
+    }
+  present_.push_back (static_cast<uint8_t> (present));
+}
+
+bool
+record_batch::has_digest (size_t i, utils::digest_algo algo) const
+{
+  return present_[i] & utils::digest_bit (algo);
+}
+
+const uint8_t *
+record_batch::digest (size_t i, utils::digest_algo algo) const
+{
+  if (!has_digest (i, algo))
+    {
+      return nullptr;
+    }
+  return &digests_data_[i * stride_ + offsets_[utils::toUType (algo)]];
+}
+
+std::string
+record_batch::digest_hex (size_t i, utils::digest_algo algo) const
+{
+  const uint8_t *data = digest (i, algo);
+  return data != nullptr ? utils::to_hex (data, utils::digest_size (algo)) : std::string{};
+}
+
+}
+}
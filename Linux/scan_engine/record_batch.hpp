@@ -0,0 +1,77 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "utils/digest.hpp"
+
+#include "scan_def.hpp"
+
+namespace scan
+{
+namespace detail
+{
+
+/*
+ * Records in structure-of-arrays form, the way they travel from the
+ * workers to the recorder and wait there: every path back to back in
+ * one buffer, a byte of file_type and a byte of digest presence per
+ * record, and the digests in binary, a fixed slot per algorithm of the
+ * batch. A record costs its path, 6 bytes and its digests (16 for MD5),
+ * where a file_info holds a slot for every algorithm and allocates its
+ * path on its own. Handing a batch over moves a few vectors.
+ */
+class record_batch
+{
+public:
+  // slots for the algorithms of `digests`, others are dropped by push
+  explicit record_batch (utils::digest_mask digests = 0);
+
+  size_t size () const { return types_.size (); }
+  bool empty () const { return types_.empty (); }
+  utils::digest_mask digests () const { return digests_; }
+  // bytes the records take, capacity left aside
+  size_t
+  bytes () const
+  {
+    return paths_.size () + path_ends_.size () * sizeof (uint32_t) + types_.size ()
+           + present_.size () + digests_data_.size ();
+  }
+
+  void reserve (size_t records, size_t path_bytes);
+  void clear ();
+  // digests as computed, one missing from the set is recorded missing
+  void push (std::string_view path, file_type type, const utils::digest_set &digests);
+
+  std::string_view
+  path (size_t i) const
+  {
+    const uint32_t begin = i == 0 ? 0 : path_ends_[i - 1];
+    return std::string_view (paths_).substr (begin, path_ends_[i] - begin);
+  }
+  file_type type (size_t i) const { return static_cast<file_type> (types_[i]); }
+  bool has_digest (size_t i, utils::digest_algo algo) const;
+  // digest_size (algo) bytes, nullptr unless has_digest
+  const uint8_t *digest (size_t i, utils::digest_algo algo) const;
+  // lowercase hex, empty unless has_digest
+  std::string digest_hex (size_t i, utils::digest_algo algo) const;
+
+private:
+  utils::digest_mask digests_;
+  // bytes per record in digests_data_, and where each algorithm starts
+  size_t stride_{};
+  std::array<size_t, utils::DIGEST_ALGO_COUNT> offsets_{};
+
+  std::string paths_;
+  std::vector<uint32_t> path_ends_;
+  std::vector<uint8_t> types_;
+  // digest_mask of the digests really there
+  std::vector<uint8_t> present_;
+  std::vector<uint8_t> digests_data_;
+};
+
+}
+}
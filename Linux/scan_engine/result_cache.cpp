@@ -0,0 +1,332 @@
+#include "result_cache.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+
+#include <sys/sysmacros.h>
+
+namespace scan
+{
+namespace detail
+{
+
+namespace
+{
+
+constexpr char CACHE_MAGIC[4] = { 'H', 'K', 'R', 'C' };
+// host byte order, a cache never leaves the machine that wrote it
+constexpr uint32_t CACHE_VERSION = 4;
+
+template <typename T>
+bool
+read_value (std::istream &in, T &value)
+{
+  return static_cast<bool> (in.read (reinterpret_cast<char *> (&value), sizeof (value)));
+}
+
+template <typename T>
+void
+write_value (std::ostream &out, const T &value)
+{
+  out.write (reinterpret_cast<const char *> (&value), sizeof (value));
+}
+
+bool
+read_stamp (std::istream &in, file_stamp &stamp)
+{
+  return read_value (in, stamp.dev) && read_value (in, stamp.ino)
+         && read_value (in, stamp.size) && read_value (in, stamp.mtime_ns)
+         && read_value (in, stamp.ctime_ns);
+}
+
+void
+write_stamp (std::ostream &out, const file_stamp &stamp)
+{
+  write_value (out, stamp.dev);
+  write_value (out, stamp.ino);
+  write_value (out, stamp.size);
+  write_value (out, stamp.mtime_ns);
+  write_value (out, stamp.ctime_ns);
+}
+
+// smallest encoding of each counted record, to check counts against the file
+constexpr size_t STAMP_SIZE = 2 * sizeof (uint64_t) + 3 * sizeof (int64_t);
+constexpr size_t MIN_ENTRY_SIZE = STAMP_SIZE + sizeof (int32_t) + sizeof (uint32_t);
+constexpr size_t MIN_LISTING_SIZE = STAMP_SIZE + sizeof (uint32_t);
+constexpr size_t MIN_LISTING_ENTRY_SIZE = sizeof (uint64_t) + 1 + sizeof (uint16_t);
+
+// whether `count` records of at least `min_size` bytes fit before `end`
+bool
+fits (std::istream &in, std::streamoff end, uint64_t count, size_t min_size)
+{
+  const std::streamoff here = in.tellg ();
+  return here >= 0 && here <= end && count <= static_cast<uint64_t> (end - here) / min_size;
+}
+
+} // namespace
+
+file_stamp
+file_stamp::from_statx (const struct statx &stx)
+{
+  file_stamp stamp;
+  stamp.dev = static_cast<uint64_t> (makedev (stx.stx_dev_major, stx.stx_dev_minor));
+  stamp.ino = stx.stx_ino;
+  stamp.size = static_cast<int64_t> (stx.stx_size);
+  stamp.mtime_ns = stx.stx_mtime.tv_sec * 1000000000 + stx.stx_mtime.tv_nsec;
+  stamp.ctime_ns = stx.stx_ctime.tv_sec * 1000000000 + stx.stx_ctime.tv_nsec;
+  return stamp;
+}
+
+bool
+result_cache::load (const std::string &path)
+{
+  previous_.clear ();
+  previous_listings_.clear ();
+
+  std::ifstream in (path, std::ios::binary | std::ios::ate);
+  if (!in)
+    {
+      return false;
+    }
+  // counts come from the file: a corrupt one mustn't size the tables
+  const std::streamoff end = in.tellg ();
+  in.seekg (0);
+
+  char magic[sizeof (CACHE_MAGIC)];
+  uint32_t version{};
+  uint64_t count{};
+  if (!in.read (magic, sizeof (magic))
+      || !std::equal (magic, magic + sizeof (magic), CACHE_MAGIC)
+      || !read_value (in, version) || version != CACHE_VERSION
+      || !read_value (in, count) || !fits (in, end, count, MIN_ENTRY_SIZE))
+    {
+      return false;
+    }
+
+  entry_map loaded;
+  loaded.reserve (count);
+  for (uint64_t i = 0; i < count; ++i)
+    {
+      entry result;
+      const file_stamp &stamp = result.stamp;
+      int32_t file_type{};
+      uint32_t digests{};
+      if (!read_stamp (in, result.stamp) || !read_value (in, file_type)
+          || !read_value (in, digests) || (digests & ~utils::ALL_DIGESTS) != 0)
+        {
+          return false;
+        }
+      result.file_type = file_type;
+
+      // each digest present, binary and digest_size bytes long
+      for (size_t algo = 0; algo < utils::DIGEST_ALGO_COUNT; ++algo)
+        {
+          const auto which = static_cast<utils::digest_algo> (algo);
+          if ((digests & (1u << algo))
+              && !in.read (reinterpret_cast<char *> (result.digests.set (which)),
+                           static_cast<std::streamsize> (utils::digest_size (which))))
+            {
+              return false;
+            }
+        }
+
+      loaded.emplace (std::make_pair (stamp.dev, stamp.ino), std::move (result));
+    }
+
+  listing_map loaded_listings;
+  if (!load_listings (in, end, loaded_listings))
+    {
+      return false;
+    }
+
+  previous_ = std::move (loaded);
+  previous_listings_ = std::move (loaded_listings);
+  return true;
+}
+
+bool
+result_cache::load_listings (std::istream &in, std::streamoff end, listing_map &loaded)
+{
+  uint64_t count{};
+  if (!read_value (in, count) || !fits (in, end, count, MIN_LISTING_SIZE))
+    {
+      return false;
+    }
+
+  loaded.reserve (count);
+  for (uint64_t i = 0; i < count; ++i)
+    {
+      auto dir = std::make_shared<listing> ();
+      uint32_t entries{};
+      if (!read_stamp (in, dir->stamp) || !read_value (in, entries)
+          || !fits (in, end, entries, MIN_LISTING_ENTRY_SIZE))
+        {
+          return false;
+        }
+
+      dir->entries.reserve (entries);
+      std::string name;
+      for (uint32_t e = 0; e < entries; ++e)
+        {
+          uint64_t ino{};
+          unsigned char type{};
+          uint16_t len{};
+          if (!read_value (in, ino) || !read_value (in, type) || !read_value (in, len))
+            {
+              return false;
+            }
+          name.resize (len);
+          if (!in.read (&name[0], len))
+            {
+              return false;
+            }
+          dir->add (name.data (), len, ino, type);
+        }
+
+      const auto key = std::make_pair (dir->stamp.dev, dir->stamp.ino);
+      loaded.emplace (key, std::move (dir));
+    }
+  return true;
+}
+
+bool
+result_cache::save (const std::string &path) const
+{
+  const std::string temp_path = path + ".tmp";
+  {
+    std::ofstream out (temp_path, std::ios::binary | std::ios::trunc);
+    if (!out)
+      {
+        return false;
+      }
+
+    uint64_t count = 0;
+    for (const auto &s : current_)
+      {
+        std::lock_guard<std::mutex> lock (s.mutex);
+        count += s.entries.size ();
+      }
+
+    out.write (CACHE_MAGIC, sizeof (CACHE_MAGIC));
+    write_value (out, CACHE_VERSION);
+    write_value (out, count);
+
+    for (const auto &s : current_)
+      {
+        std::lock_guard<std::mutex> lock (s.mutex);
+        for (const auto &item : s.entries)
+          {
+            const entry &result = item.second;
+            write_stamp (out, result.stamp);
+            write_value (out, static_cast<int32_t> (result.file_type));
+            write_value (out, static_cast<uint32_t> (result.digests.present ()));
+            for (size_t algo = 0; algo < utils::DIGEST_ALGO_COUNT; ++algo)
+              {
+                const auto which = static_cast<utils::digest_algo> (algo);
+                if (const uint8_t *digest = result.digests.get (which))
+                  {
+                    out.write (reinterpret_cast<const char *> (digest),
+                               static_cast<std::streamsize> (utils::digest_size (which)));
+                  }
+              }
+          }
+      }
+    save_listings (out);
+
+    if (!out.flush ())
+      {
+        std::remove (temp_path.c_str ());
+        return false;
+      }
+  }
+  return std::rename (temp_path.c_str (), path.c_str ()) == 0;
+}
+
+void
+result_cache::save_listings (std::ostream &out) const
+{
+  uint64_t count = 0;
+  for (const auto &s : current_)
+    {
+      std::lock_guard<std::mutex> lock (s.mutex);
+      count += s.listings.size ();
+    }
+  write_value (out, count);
+
+  for (const auto &s : current_)
+    {
+      std::lock_guard<std::mutex> lock (s.mutex);
+      for (const auto &item : s.listings)
+        {
+          const listing &dir = *item.second;
+          write_stamp (out, dir.stamp);
+          write_value (out, static_cast<uint32_t> (dir.entries.size ()));
+          for (const auto &dir_entry : dir.entries)
+            {
+              write_value (out, dir_entry.ino);
+              write_value (out, dir_entry.type);
+              write_value (out, dir_entry.name_size);
+              out.write (dir.name_of (dir_entry), dir_entry.name_size);
+            }
+        }
+    }
+}
+
+bool
+result_cache::lookup (const file_stamp &stamp, entry &out)
+{
+  const auto key = std::make_pair (stamp.dev, stamp.ino);
+  shard &s = shard_of (stamp.ino);
+  {
+    // hard links and symlinks reach the same inode more than once a scan
+    std::lock_guard<std::mutex> lock (s.mutex);
+    auto found = s.entries.find (key);
+    if (found != s.entries.end () && found->second.stamp.same_content (stamp))
+      {
+        out = found->second;
+        return true;
+      }
+  }
+
+  auto found = previous_.find (key);
+  if (found == previous_.end () || !found->second.stamp.same_content (stamp))
+    {
+      return false;
+    }
+  out = found->second;
+  store (out);
+  return true;
+}
+
+void
+result_cache::store (const entry &result)
+{
+  shard &s = shard_of (result.stamp.ino);
+  std::lock_guard<std::mutex> lock (s.mutex);
+  s.entries[std::make_pair (result.stamp.dev, result.stamp.ino)] = result;
+}
+
+std::shared_ptr<const result_cache::listing>
+result_cache::lookup_listing (const file_stamp &stamp)
+{
+  auto found = previous_listings_.find (std::make_pair (stamp.dev, stamp.ino));
+  if (found == previous_listings_.end () || !found->second->stamp.same_content (stamp))
+    {
+      return {};
+    }
+  store_listing (found->second);
+  return found->second;
+}
+
+void
+result_cache::store_listing (std::shared_ptr<const listing> dir)
+{
+  shard &s = shard_of (dir->stamp.ino);
+  const auto key = std::make_pair (dir->stamp.dev, dir->stamp.ino);
+  std::lock_guard<std::mutex> lock (s.mutex);
+  s.listings[key] = std::move (dir);
+}
+
+}
+}
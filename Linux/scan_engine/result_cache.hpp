@@ -0,0 +1,136 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <sys/stat.h>
+
+#include "utils/digest.hpp"
+
+namespace scan
+{
+namespace detail
+{
+
+// identity and change metadata of a file, as far as the cache can tell
+struct file_stamp
+{
+  uint64_t dev{};
+  uint64_t ino{};
+  int64_t size{};
+  int64_t mtime_ns{};
+  int64_t ctime_ns{};
+
+  // ino 0 never names a file: the record wasn't stat'ed
+  bool known () const { return ino != 0; }
+  bool same_content (const file_stamp &other) const
+  {
+    return size == other.size && mtime_ns == other.mtime_ns
+           && ctime_ns == other.ctime_ns;
+  }
+
+  static file_stamp from_statx (const struct statx &stx);
+};
+
+/*
+ * Results of the previous scan, keyed on (dev, ino) and valid while
+ * size, mtime and ctime still match. Files that aren't ELF are cached
+ * too, with NOT_ELF as their type, so they aren't opened again.
+ * Directories keep their entry list the same way: any entry added,
+ * removed or renamed moves the directory's mtime.
+ *
+ * The loaded file is only read during a scan; everything the scan
+ * meets, hit or not, goes to the current generation, which is what
+ * save() writes. Files gone since last time drop out on their own.
+ */
+class result_cache
+{
+public:
+  static constexpr int NOT_ELF = -1;
+
+  struct entry
+  {
+    file_stamp stamp;
+    int file_type{ NOT_ELF };
+    utils::digest_set digests;
+  };
+
+  struct listing_entry
+  {
+    uint64_t ino{};
+    // where the name starts in the listing's names, and its length
+    uint32_t name{};
+    uint16_t name_size{};
+    // d_type, DT_UNKNOWN already resolved
+    unsigned char type{};
+  };
+
+  struct listing
+  {
+    file_stamp stamp;
+    // every entry's name, NUL-terminated, back to back: no string each
+    std::string names;
+    std::vector<listing_entry> entries;
+
+    const char *name_of (const listing_entry &entry) const { return names.c_str () + entry.name; }
+    void
+    add (const char *name, size_t size, uint64_t ino, unsigned char type)
+    {
+      entries.push_back ({ ino, static_cast<uint32_t> (names.size ()),
+                           static_cast<uint16_t> (size), type });
+      names.append (name, size);
+      names.push_back ('\0');
+    }
+  };
+
+  // false, with the cache left empty, if the file is missing or unusable
+  bool load (const std::string &path);
+  // written aside and renamed over `path`
+  bool save (const std::string &path) const;
+
+  // thread safe; a hit is carried over to the current generation
+  bool lookup (const file_stamp &stamp, entry &out);
+  void store (const entry &result);
+
+  // null on a miss; listings are shared, never modified once stored
+  std::shared_ptr<const listing> lookup_listing (const file_stamp &stamp);
+  void store_listing (std::shared_ptr<const listing> dir);
+
+private:
+  struct key_hash
+  {
+    size_t operator() (const std::pair<uint64_t, uint64_t> &key) const
+    {
+      return std::hash<uint64_t>{}(key.second * 0x9e3779b97f4a7c15ULL ^ key.first);
+    }
+  };
+  using entry_map = std::unordered_map<std::pair<uint64_t, uint64_t>, entry, key_hash>;
+  using listing_map = std::unordered_map<std::pair<uint64_t, uint64_t>,
+                                         std::shared_ptr<const listing>, key_hash>;
+
+  struct shard
+  {
+    mutable std::mutex mutex;
+    entry_map entries;
+    listing_map listings;
+  };
+
+  bool load_listings (std::istream &in, std::streamoff end, listing_map &loaded);
+  void save_listings (std::ostream &out) const;
+
+  static constexpr size_t SHARD_COUNT = 64;
+  shard &shard_of (uint64_t ino) { return current_[ino % SHARD_COUNT]; }
+
+private:
+  entry_map previous_;
+  listing_map previous_listings_;
+  std::array<shard, SHARD_COUNT> current_;
+};
+
+}
+}
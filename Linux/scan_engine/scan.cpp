@@ -21,6 +21,12 @@ scanner::scanner (unsigned int max_thread_hint)
 
 }
 
+scanner::scanner (std::shared_ptr<utils::thread_pool> pool)
+  : s_pointer_ (std::make_shared<detail::scan_private> (std::move (pool)))
+{
+
+}
+
 scanner::~scanner () 
 {
 
@@ -39,6 +45,78 @@ void scanner::add_path(const std::vector<std::string>& scan_paths)
     }
 }
 
+void
+scanner::set_digests(unsigned int digest_mask)
+{
+  s_pointer_->set_digests(digest_mask);
+}
+
+void
+scanner::set_cache_path(const std::string& cache_path)
+{
+  s_pointer_->set_cache_path(cache_path);
+}
+
+void
+scanner::set_continuous(bool continuous)
+{
+  s_pointer_->set_continuous(continuous);
+}
+
+void
+scanner::set_one_filesystem(bool one_filesystem)
+{
+  s_pointer_->set_one_filesystem(one_filesystem);
+}
+
+void
+scanner::set_traversal(traversal_order order, bool inode_sorted)
+{
+  s_pointer_->set_traversal(order, inode_sorted);
+}
+
+void
+scanner::set_require_exec_bit(bool require_exec_bit)
+{
+  s_pointer_->set_require_exec_bit(require_exec_bit);
+}
+
+std::shared_ptr<utils::thread_pool>
+scanner::shared_pool ()
+{
+  return utils::thread_pool::shared ();
+}
+
+void
+scanner::set_io_engine(io_engine engine)
+{
+  s_pointer_->set_io_engine(engine);
+}
+
+void
+scanner::set_adaptive_concurrency(bool adaptive)
+{
+  s_pointer_->set_adaptive_concurrency(adaptive);
+}
+
+void
+scanner::set_result_handler(result_handler handler, size_t max_backlog)
+{
+  s_pointer_->set_result_handler(std::move (handler), max_backlog);
+}
+
+void
+scanner::set_database_path(const std::string& db_path)
+{
+  s_pointer_->set_database_path(db_path);
+}
+
+void
+scanner::set_snapshot_path(const std::string& snapshot_path)
+{
+  s_pointer_->set_snapshot_path(snapshot_path);
+}
+
 void
 scanner::wait ()
 {
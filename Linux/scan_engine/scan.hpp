@@ -5,6 +5,13 @@
 #include <memory>
 #include <string>
 
+#include "scan_def.hpp"
+
+namespace utils
+{
+  class thread_pool;
+}
+
 namespace scan
 {
 
@@ -18,6 +25,9 @@ class scanner
 public:
 
   explicit scanner (unsigned int max_thread_hint = 3);
+  // runs on `pool` alongside whatever else uses it, shared_pool () for
+  // one pool sized to the machine
+  explicit scanner (std::shared_ptr<utils::thread_pool> pool);
   ~scanner ();
 
   scanner (scanner const &) = delete;
@@ -34,8 +44,55 @@ public:
   void add_path(const std::string& scan_path);
   void add_path(const std::vector<std::string>& scan_paths);
 
+  // bitwise or of digest_type, computed in one read per file; default MD5
+  void set_digests(unsigned int digest_mask);
+
+  // reuse unchanged files' results from the last scan, saved back when done
+  void set_cache_path(const std::string& cache_path);
+
+  // after the initial scan, follow filesystem changes until stop()
+  void set_continuous(bool continuous);
+
+  // stay on the filesystems of the scan paths, like find -xdev
+  void set_one_filesystem(bool one_filesystem);
+
+  // inode_sorted: visit each directory's entries by inode number, which
+  // follows the on-disk layout of ext4/xfs; default DFS, listing order.
+  // A pool passed in keeps its own task order, BFS then only orders the
+  // tasks waiting on a device
+  void set_traversal(traversal_order order, bool inode_sorted = false);
+
+  // skip files without any execute bit before opening them; note that
+  // many distributions ship shared libraries 0644
+  void set_require_exec_bit(bool require_exec_bit);
+
+  // THREADS by default; set_traversal and the per-device queues
+  // don't apply to COROUTINES, which keeps every directory in flight
+  void set_io_engine(io_engine engine);
+
+  // resize the pool while scanning, after the entries listed per second
+  // and the time an I/O task takes: on by default with a pool of the
+  // scanner's own, off on one passed in, which others may count on
+  void set_adaptive_concurrency(bool adaptive);
+
+  // records as they are classified, in batches of about a directory,
+  // on one thread; past max_backlog records not yet handled (0: 64Ki)
+  // the workers wait for it. Without one they are dropped. Before launch.
+  void set_result_handler(result_handler handler, size_t max_backlog = 0);
+
+  // also keep the whitelist in an SQLite file, table `whitelist`, which
+  // can be read while the scan runs; needs a build with HK_SQLITE
+  void set_database_path(const std::string& db_path);
+
+  // once the initial scan is over, write the whitelist there for
+  // whitelist_snapshot to map; not after an interrupted scan
+  void set_snapshot_path(const std::string& snapshot_path);
+
   bool is_scan_over () const;
 
+  // the process-wide pool, made on first use
+  static std::shared_ptr<utils::thread_pool> shared_pool ();
+
   void stop ();
 
 private:
@@ -1,5 +1,10 @@
 #pragma once
 
+#include <array>
+#include <functional>
+#include <string>
+#include <vector>
+
 namespace scan
 {
 
@@ -12,7 +17,58 @@ enum class file_type : unsigned int
 
   // elf type
   DYN,
-  EXE
+  EXE,
+
+  // continuous mode: the path is no longer whitelisted, a directory
+  // path (trailing '/') takes everything under it
+  REMOVED
+};
+
+enum class traversal_order : unsigned int
+{
+  // each worker goes down its own subtree first: small frontier, warm caches
+  DFS,
+  // level by level, the widest frontier
+  BFS
+};
+
+// how the scan drives its I/O
+enum class io_engine : unsigned int
+{
+  // blocking calls in pool tasks, one directory per task
+  THREADS,
+  // coroutines on an io_uring reactor, many files in flight per thread;
+  // only with HK_COROUTINES=ON, THREADS otherwise
+  COROUTINES
 };
 
-}
\ No newline at end of file
+// digests recorded for every whitelisted file, combined as a bit mask
+enum class digest_type : unsigned int
+{
+  MD5 = 1 << 0,
+  SHA256 = 1 << 1,
+  BLAKE3 = 1 << 2,
+  XXH3 = 1 << 3
+};
+
+// one whitelisted file, as handed to the result handler
+struct scan_record
+{
+  std::string path;
+  // EXE or DYN, REMOVED in continuous mode
+  file_type type{};
+  // lowercase hex, one slot per digest_type in bit order, empty when not computed
+  std::array<std::string, 4> digests;
+
+  const std::string &
+  digest (digest_type type) const
+  {
+    return digests[__builtin_ctz (static_cast<unsigned int> (type))];
+  }
+};
+
+// takes a batch of records, which it may move from; runs on the scan's
+// recorder thread, and the scan slows down while it lags
+using result_handler = std::function<void (std::vector<scan_record> &records)>;
+
+}
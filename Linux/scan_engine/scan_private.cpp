@@ -1,17 +1,31 @@
 #include "scan_private.hpp"
 
 #include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <unordered_map>
 #include <fmt/core.h>
 
 #include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
 #include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <sys/fanotify.h>
 
 #include "scan.hpp"
 #include "scan_def.hpp"
 
 #include "utils/elf_check.hpp"
+#include "utils/elf_batch.hpp"
 #include "utils/utils.hpp"
-#include "utils/md5.hpp"
+#include "utils/digest.hpp"
+#include "utils/blake3.hpp"
+#include "utils/scoped_fd.hpp"
+
+#include "concurrency_tuner.hpp"
 
 
 namespace scan
@@ -19,17 +33,118 @@ namespace scan
 namespace detail
 {
 
+static_assert (utils::toUType (digest_type::MD5) == utils::digest_bit (utils::digest_algo::MD5)
+                   && utils::toUType (digest_type::SHA256) == utils::digest_bit (utils::digest_algo::SHA256)
+                   && utils::toUType (digest_type::BLAKE3) == utils::digest_bit (utils::digest_algo::BLAKE3)
+                   && utils::toUType (digest_type::XXH3) == utils::digest_bit (utils::digest_algo::XXH3),
+               "scan::digest_type must mirror utils::digest_algo");
+static_assert (std::tuple_size<decltype (scan_record::digests)>::value == utils::DIGEST_ALGO_COUNT,
+               "scan_record holds one digest per utils::digest_algo");
+
+namespace
+{
+
+// a segment is a complete subtree of the blake3 tree: 1 MiB, 1024 chunks
+constexpr uint64_t TREE_SEGMENT_CHUNKS = 1024;
+constexpr uint64_t TREE_SEGMENT_SIZE = TREE_SEGMENT_CHUNKS * utils::blake3_hasher::CHUNK_LEN;
+// below this a file is hashed in the batch of its directory
+constexpr off_t TREE_HASH_MIN_SIZE = 16 * 1024 * 1024;
+
+// entries a task checks in a directory too big for one worker
+constexpr size_t CHECK_BATCH_SIZE = 1024;
+
+// records waiting for the result handler or the database before producers wait
+constexpr size_t DEFAULT_MAX_BACKLOG = 64 * 1024;
+
+// how long the worker count is measured before it is changed again
+constexpr auto TUNING_INTERVAL = std::chrono::milliseconds (250);
+
+// how long changes seen in continuous mode stay out of the cache file
+constexpr auto CACHE_SAVE_INTERVAL = std::chrono::seconds (60);
+
+// bytes read, short only at end of file
+ssize_t
+read_at (int fd, uint8_t *buffer, size_t size, off_t offset)
+{
+  size_t done = 0;
+  while (done < size)
+    {
+      const ssize_t nread = ::pread (fd, buffer + done, size - done, offset + done);
+      if (nread < 0 && errno == EINTR)
+        {
+          continue;
+        }
+      if (nread < 0)
+        {
+          return -1;
+        }
+      if (nread == 0)
+        {
+          break;
+        }
+      done += static_cast<size_t> (nread);
+    }
+  return static_cast<ssize_t> (done);
+}
+
+// one segment, reused by every tree job the worker runs
+std::vector<uint8_t> &
+segment_buffer ()
+{
+  thread_local std::vector<uint8_t> buffer (TREE_SEGMENT_SIZE);
+  return buffer;
+}
+
+} // namespace
+
+struct scan_private::tree_hash_job
+{
+  explicit tree_hash_job (int file_fd) : fd (file_fd) {}
+
+  file_info info;
+  usb::ScopedFd fd;
+  uint64_t size{};
+  // one per segment, combined in file order once all are in
+  std::vector<utils::blake3_hasher::chaining_value> cvs;
+  std::atomic<size_t> pending{};
+  std::atomic_bool failed{};
+};
 
 scan_private::scan_private (unsigned int max_thread_hint)
-    : db_recorder_ (this, &scan_private::write_to_db_),
+    : scan_private (std::make_shared<thread_pool> (max_thread_hint))
+{
+  // the hint is only where it starts: the pool is ours to resize
+  owns_pool_ = true;
+  adaptive_ = true;
+}
+
+scan_private::scan_private (std::shared_ptr<thread_pool> pool)
+    : pool_ (std::move (pool)),
+      io_queues_ (*pool_, tasks_),
+      db_recorder_ (this, &scan_private::write_to_db_),
       notifier_ (this, &scan_private::status_notifier),
-      task_pool_{max_thread_hint}
+      tuner_ (this, &scan_private::tune_concurrency_)
+#ifdef HK_WITH_COROUTINES
+      , coro_runner_ (this, &scan_private::run_coroutines_)
+#endif
 {
+  struct rlimit nofile{};
+  if (::getrlimit (RLIMIT_NOFILE, &nofile) == 0 && nofile.rlim_cur != RLIM_INFINITY)
+    {
+      // leave the other half to file checks and the rest of the process
+      max_shared_dir_fds_ = static_cast<int> (nofile.rlim_cur / 2);
+    }
+  else
+    {
+      max_shared_dir_fds_ = 4096;
+    }
 }
 
 scan_private::~scan_private()
 {
   wait();
+  // continuous mode may have left some behind, cancelled by stop ()
+  tasks_.wait ();
   fmt::print ("start time point  : {}\n", time_start_);
   fmt::print ("end time point    : {}\n", time_end_);
   fmt::print ("operation duration: {}ms\n", time_end_-time_start_);
@@ -42,6 +157,86 @@ scan_private::set_path(const std::string& scan_path)
   unscanned_dirs_.emplace_back(scan_path);
 }
 
+void
+scan_private::set_digests(utils::digest_mask digests)
+{
+  digests_ = digests & utils::ALL_DIGESTS;
+}
+
+void
+scan_private::set_cache_path(const std::string& cache_path)
+{
+  cache_path_ = cache_path;
+}
+
+void
+scan_private::set_continuous(bool continuous)
+{
+  continuous_ = continuous;
+}
+
+void
+scan_private::set_one_filesystem(bool one_filesystem)
+{
+  mounts_.set_one_filesystem (one_filesystem);
+}
+
+void
+scan_private::set_require_exec_bit(bool require_exec_bit)
+{
+  require_exec_bit_ = require_exec_bit;
+}
+
+void
+scan_private::set_io_engine(io_engine engine)
+{
+  engine_ = engine;
+}
+
+void
+scan_private::set_adaptive_concurrency(bool adaptive)
+{
+  adaptive_ = adaptive;
+}
+
+void
+scan_private::set_result_handler(result_handler handler, size_t max_backlog)
+{
+  handler_ = std::move (handler);
+  max_backlog_ = max_backlog;
+}
+
+void
+scan_private::set_database_path(const std::string& db_path)
+{
+  db_path_ = db_path;
+}
+
+void
+scan_private::set_snapshot_path(const std::string& snapshot_path)
+{
+  snapshot_path_ = snapshot_path;
+}
+
+void
+scan_private::set_traversal(traversal_order order, bool inode_sorted)
+{
+  order_ = order;
+  inode_sorted_ = inode_sorted;
+  const auto task_order
+      = order == traversal_order::DFS ? utils::task_order::LIFO : utils::task_order::FIFO;
+  io_queues_.set_task_order (task_order);
+  // pool wide: a pool passed in keeps the order its other users count on
+  if (owns_pool_)
+    {
+      pool_->set_task_order (task_order);
+    }
+  else if (order != traversal_order::DFS)
+    {
+      fmt::print ("shared pool keeps its task order, only device queues follow\n");
+    }
+}
+
 
 void 
 scan_private::launch()
@@ -52,11 +247,88 @@ scan_private::launch()
   file_counts_ = unscanned_dirs_.size();
   time_start_ = utils::timestamp_since_epoch<std::chrono::milliseconds> ();
 
+  if (mounts_.load ())
+    {
+      mounts_.plan ({ unscanned_dirs_.begin (), unscanned_dirs_.end () });
+    }
+
+  if (!cache_path_.empty () && !cache_.load (cache_path_))
+    {
+      fmt::print ("no usable result cache at {}, full scan\n", cache_path_);
+    }
+
+  // before any producer runs: they look at throttled_
+#ifdef HK_WITH_SQLITE
+  if (!db_path_.empty ())
+    {
+      sink_ = std::make_unique<sqlite_sink> ();
+      if (!sink_->open (db_path_))
+        {
+          sink_.reset ();
+        }
+    }
+  throttled_ = handler_ || sink_;
+#else
+  if (!db_path_.empty ())
+    {
+      fmt::print ("built without sqlite, {} not written\n", db_path_);
+    }
+  throttled_ = static_cast<bool> (handler_);
+#endif
+  if (max_backlog_ == 0)
+    {
+      max_backlog_ = DEFAULT_MAX_BACKLOG;
+    }
+
+  if (continuous_)
+    {
+      // marked before walking: nothing changed during the walk is missed
+      bool watching = watcher_.open ();
+      for (const auto &dir : unscanned_dirs_)
+        {
+          watching = watching && watcher_.add_filesystem (dir);
+          // events carry resolved paths
+          char resolved[PATH_MAX];
+          std::string root = ::realpath (dir.c_str (), resolved) != nullptr ? resolved : dir;
+          if (root.empty () || root.back () != '/')
+            {
+              root += '/';
+            }
+          watched_roots_.push_back (std::move (root));
+        }
+      if (!watching)
+        {
+          fmt::print ("fanotify unavailable, errno:{}, single scan only\n", errno);
+          continuous_ = false;
+        }
+    }
+
+#ifdef HK_WITH_COROUTINES
+  if (engine_ == io_engine::COROUTINES)
+    {
+      // the reactor walks the roots itself
+      coro_running_ = true;
+      coro_runner_.start ();
+    }
+  else
+#endif
   for(auto&& dir : unscanned_dirs_)
   {
-    task_pool_.push_task(&scan_private::do_scan, this, dir);
+    if (!valid_path (dir))
+      {
+        fmt::print ("skip scan path:{}\n", dir);
+        continue;
+      }
+    struct stat st{};
+    schedule_scan_ (paths_, ::stat (dir.c_str (), &st) == 0 ? st.st_dev : 0, dir, {});
   }
 
+  // the coroutines keep their I/O on the reactor, the pool only lists
+  if (adaptive_ && engine_ == io_engine::THREADS)
+    {
+      tuner_.start ();
+    }
+
   // recorder start
   db_recorder_.start();
 
@@ -70,6 +342,7 @@ scan_private::wait()
 {
   notifier_.wait();
   fmt::print("notifier off\n");
+  tuner_.wait ();
   db_recorder_.wait();
   fmt::print("db_recorder off\n");
 }
@@ -78,239 +351,1189 @@ void
 scan_private::stop ()
 {
   running_ = false;
-  task_pool_.pause();
+  // coroutines wait on their pool work: it drains, no directory is entered
+  if (!coro_running_)
+    {
+      tasks_.cancel ();
+    }
+  watcher_.interrupt ();
+  file_infos_.close ();
+  close_backlog_ ();
+  end_tuning_ ();
 }
 
 bool
 scan_private::is_scan_over() const
 {
-  return task_pool_.get_tasks_count() == 0;
+  return tasks_.idle () && !coro_running_;
 }
 
 
 void
-scan_private::do_scan(const std::string& curr_dir_path)
+scan_private::do_scan(const std::shared_ptr<path_tree>& tree,
+                      const path_tree::node* curr_dir_node,
+                      const std::shared_ptr<dir_reader>& parent_dir)
 {
-  if(!running_ || !valid_path (curr_dir_path)) return ;
+  if (!running_) return ;
 
-  std::vector<std::string> out_dirs{};
-  std::vector<std::string> out_files{};
-  std::vector<std::string> out_symbols{};
+  // the one copy of the path this directory gets, its files build on it
+  std::string curr_dir_path;
+  tree->path_of (curr_dir_node, curr_dir_path);
+  if (!valid_dir_ (curr_dir_path)) return ;
+
+  auto curr_dir = open_dir_ (curr_dir_node, curr_dir_path, parent_dir);
+  if (!curr_dir->is_open ())
+    {
+      // todo: log
+      return;
+    }
 
-  traverse_dir_ (curr_dir_path, out_dirs, out_files, out_symbols);
+  auto entries = std::make_shared<dir_entries> ();
+  list_dir_ (*curr_dir, *tree, curr_dir_node, curr_dir_path, *entries);
+  auto &out_dirs = entries->dirs;
+  const auto &out_files = entries->files;
+  const auto &out_symbols = entries->symbols;
   file_counts_.fetch_add (
       (out_dirs.size () + out_files.size () + out_symbols.size ()));
 
-  /* update unscanned dir */
-  {
-    std::unique_lock<std::mutex> dir_lk (dir_mutex_);
-    for (auto &&to_be_scan : out_dirs)
-      {
-        task_pool_.push_task (&scan_private::do_scan, this, to_be_scan);
-      }
-  }
+  // a huge directory is checked by the whole pool, a batch per task
+  const bool split_checks = out_files.size () + out_symbols.size () > CHECK_BATCH_SIZE;
 
+  /* update unscanned dir */
+  std::shared_ptr<dir_reader> shared_dir{};
+  uint64_t dev = 0;
+  if (!out_dirs.empty () || split_checks)
+    {
+      // children are on this device, but for mount points
+      struct stat st{};
+      dev = ::fstat (curr_dir->fd (), &st) == 0 ? st.st_dev : 0;
+      shared_dir = share_dir_ (curr_dir);
+    }
+  if (!out_dirs.empty ())
+    {
+      if (order_ == traversal_order::DFS)
+        {
+          // popped newest first: pushed backwards, walked in listing order
+          std::reverse (out_dirs.begin (), out_dirs.end ());
+        }
+      schedule_scans_ (tree, dev, out_dirs, shared_dir);
+    }
   /* update elf files */
-  {
-    std::unique_lock<std::mutex> file_info_lock (file_info_mutex_);
-    for (const auto &file_path : out_files)
-      {
-        file_checker (file_path);
-      }
-
-    for (const auto &sym_path : out_symbols)
-      {
-        symbol_reloader (sym_path);
-      }
-  }
+  if (split_checks && shared_dir)
+    {
+      // batches share the directory fd and the listing, both go with the last of them
+      std::shared_ptr<const dir_entries> shared_entries = entries;
+      std::vector<device_task> batches;
+      const auto push_batches = [&] (size_t count, bool symbols) {
+        for (size_t begin = 0; begin < count; begin += CHECK_BATCH_SIZE)
+          {
+            batches.emplace_back ([this, shared_dir, tree, curr_dir_node, shared_entries,
+                                   symbols, begin] () {
+              check_batch_ (shared_dir, tree, curr_dir_node, shared_entries, symbols, begin);
+            });
+          }
+      };
+      push_batches (out_files.size (), false);
+      push_batches (out_symbols.size (), true);
+      io_queues_.push_all (dev, batches);
+    }
+  else
+    {
+      check_entries_ (shared_dir ? shared_dir->fd () : curr_dir->fd (), curr_dir_path,
+                      out_files.data (), out_files.size (), out_symbols.data (),
+                      out_symbols.size ());
+    }
 
   /* update statistics */
   time_end_ = utils::timestamp_since_epoch<std::chrono::milliseconds> ();
 }
 
-
 void
-scan_private::traverse_dir_ (std::string const &path,
-                        std::vector<std::string> &out_dirs,
-                        std::vector<std::string> &out_files,
-                        std::vector<std::string> &out_symbols)
+scan_private::check_batch_ (const std::shared_ptr<dir_reader> &dir,
+                            const std::shared_ptr<path_tree> &tree,
+                            const path_tree::node *dir_node,
+                            const std::shared_ptr<const dir_entries> &entries, bool symbols,
+                            size_t begin)
 {
-
-  // In C++17, the decltype keyword does not automatically 
-  // deduce the correct type of a function pointer. Instead, 
-  // you need to specify the correct type explicitly.
-  std::unique_ptr<DIR, decltype (&::closedir)> dirobj (
-      ::opendir (path.c_str ()), &::closedir);
-
-  // std::unique_ptr<DIR, int(*)(DIR*)> dirobj(::opendir(path.c_str()), static_cast<int(*)(DIR*)>(&::closedir));
-
-  
-  if (!dirobj)
+  if (!running_)
     {
-      // todo: log
       return;
     }
-
-  struct dirent *dir_entry = nullptr;
-  while ((dir_entry = readdir (dirobj.get ())) != nullptr)
+  std::string dir_path;
+  tree->path_of (dir_node, dir_path);
+  const auto &names = symbols ? entries->symbols : entries->files;
+  const size_t count = std::min (CHECK_BATCH_SIZE, names.size () - begin);
+  if (symbols)
     {
-      if (!running_)
-        break;
+      check_entries_ (dir->fd (), dir_path, nullptr, 0, names.data () + begin, count);
+    }
+  else
+    {
+      check_entries_ (dir->fd (), dir_path, names.data () + begin, count, nullptr, 0);
+    }
+  time_end_ = utils::timestamp_since_epoch<std::chrono::milliseconds> ();
+}
 
-      const std::string filename = dir_entry->d_name;
+void
+scan_private::check_entries_ (int dirfd, const std::string &dir_path,
+                              const char *const *files, size_t file_count,
+                              const char *const *symbols, size_t symbol_count)
+{
+  file_info_batch out_infos{};
+  // answered by the result cache, nothing left to hash
+  file_info_batch done_infos{};
+  // `dir_path + name`, rebuilt in place for each entry
+  std::string file_path = dir_path;
+  const auto path_of = [&] (const char *name) -> const std::string & {
+    file_path.resize (dir_path.size ());
+    file_path += name;
+    return file_path;
+  };
 
-      // jump these
-      if (filename == "." || filename == "..")
+  // headers of what passes the metadata screen are read in one batch
+  std::vector<utils::elf_probe> probes;
+  std::vector<file_stamp> stamps;
+  for (size_t i = 0; i < file_count; ++i)
+    {
+      file_stamp stamp{};
+      if (screen_file_ (dirfd, files[i], path_of (files[i]), stamp, out_infos, done_infos))
         {
-          continue;
+          probes.push_back ({ dirfd, files[i], utils::ELF_PROBE_INVALID });
+          stamps.push_back (stamp);
         }
-      const auto fullpath = path + filename;
-      fmt::print("scanning: {}\n", fullpath);
+    }
+  utils::check_if_valid_elfs (probes);
+  for (size_t i = 0; i < probes.size (); ++i)
+    {
+      record_elf_ (probes[i].elf_type, path_of (probes[i].name), stamps[i], out_infos);
+    }
 
-      // if dir
-      if (dir_entry->d_type == DT_DIR)
-        {
-          out_dirs.emplace_back (fullpath + '/');
-        }
-      else if (dir_entry->d_type == DT_REG)
-        {
-          out_files.emplace_back (fullpath);
-        }
-      else if (dir_entry->d_type == DT_LNK)
-        {
-          out_symbols.emplace_back (fullpath);
-        }
+  for (size_t i = 0; i < symbol_count; ++i)
+    {
+      symbol_reloader (path_of (symbols[i]), out_infos, done_infos);
     }
 
+  publish_infos_ (dirfd, dir_path.size (), out_infos, done_infos);
 }
 
 void
-scan_private::write_to_db_()
+scan_private::schedule_scan_ (const std::shared_ptr<path_tree> &tree, uint64_t dev,
+                              const std::string &dir,
+                              const std::shared_ptr<dir_reader> &parent_dir)
 {
-    std::unique_lock<std::mutex> file_info_lock (file_info_mutex_, std::defer_lock);
-  // when force exit will drive worker thread join
-  // just wait and clear the filemap
-  decltype(file_infos_) local_file_infos;
-  while (running_  || !file_infos_.empty ())
+  const path_tree::node *root = tree->add_root (dir);
+  io_queues_.push (dev, [this, tree, root, parent_dir] () { do_scan (tree, root, parent_dir); });
+}
+
+void
+scan_private::schedule_scans_ (const std::shared_ptr<path_tree> &tree, uint64_t dev,
+                               const std::vector<const path_tree::node *> &dirs,
+                               const std::shared_ptr<dir_reader> &parent_dir)
+{
+  // a directory's children go in together: one lock each for the device and the pool
+  std::vector<device_task> tasks;
+  tasks.reserve (dirs.size ());
+  for (const auto *dir : dirs)
     {
-      std::this_thread::sleep_for(std::chrono::milliseconds(50));
-      file_info_lock.lock();
-      // if (file_infos_.size () > 2000 || !running_)
-        {
-          local_file_infos.swap(file_infos_);
-        }
-      file_info_lock.unlock ();
+      tasks.emplace_back ([this, tree, dir, parent_dir] () { do_scan (tree, dir, parent_dir); });
+    }
+  io_queues_.push_all (dev, tasks);
+}
 
-      // after swap
-      if (!local_file_infos.empty ())
-        {
-          // add to whitelist
-          local_file_infos.clear ();
-        }
+std::unique_ptr<dir_reader>
+scan_private::open_dir_ (const path_tree::node *node, const std::string &path,
+                         const std::shared_ptr<dir_reader> &parent_dir)
+{
+  if (parent_dir)
+    {
+      return std::make_unique<dir_reader> (parent_dir->fd (), node->name ());
     }
+  return std::make_unique<dir_reader> (path);
 }
 
-void
-scan_private::file_checker (const std::string &fullpath)
+std::shared_ptr<dir_reader>
+scan_private::share_dir_ (std::unique_ptr<dir_reader> &dir)
 {
-  int elf_type{};
-  if (::utils::check_if_valid_elf (fullpath, elf_type))
+  // out of budget: `dir` stays with the caller and
+  // children fall back to opening by full path
+  if (shared_dir_fds_.fetch_add (1) >= max_shared_dir_fds_)
     {
-      switch (elf_type)
-        {
-        case ET_EXEC:
-          {
-            this->file_infos_.emplace_back (
-              std::make_tuple ( fullpath, utils::toUType(file_type::EXE), ::utils::md5 (fullpath)));
-            break;
-          }
-        case ET_DYN:
-          {
-            this->file_infos_.emplace_back (
-                std::make_tuple (fullpath, utils::toUType(file_type::DYN), ::utils::md5 (fullpath)));
-            break;
-          }
-        case ET_NONE:
-        default:
-          break;
-        }
+      shared_dir_fds_.fetch_sub (1);
+      return {};
     }
+
+  return std::shared_ptr<dir_reader> (dir.release (), [this] (dir_reader *dir) {
+    delete dir;
+    shared_dir_fds_.fetch_sub (1);
+  });
 }
 
+
 void
-scan_private::symbol_reloader (const std::string &symbolic_path)
+scan_private::list_dir_ (dir_reader &dir, path_tree &tree, const path_tree::node *node,
+                         std::string const &path, dir_entries &out)
 {
-  char sym_absolute_path[PATH_MAX] = { 0 };
-  if (::realpath (symbolic_path.c_str (), sym_absolute_path) == nullptr)
+  out.listing = read_listing_ (dir);
+  const auto &listing = *out.listing;
+
+  std::vector<const result_cache::listing_entry *> entries;
+  entries.reserve (listing.entries.size ());
+  for (const auto &dir_entry : listing.entries)
     {
-      fmt::print ("no final target at symbol:{}, errno:{}\n", symbolic_path,
-                 errno);
-      return;
+      entries.push_back (&dir_entry);
     }
-  if (!valid_path (sym_absolute_path))
+  if (inode_sorted_)
     {
-      fmt::print ("skip symbol_path:{}\n", symbolic_path);
-      return;
+      // the inode table is laid out in inode order: opens and stats seek less
+      std::sort (entries.begin (), entries.end (),
+                 [] (const result_cache::listing_entry *lhs,
+                     const result_cache::listing_entry *rhs) { return lhs->ino < rhs->ino; });
     }
 
-  int elf_type{};
-  fmt::print ("symbol: {} => real path: {}\n", symbolic_path, sym_absolute_path);
-  if (::utils::check_if_valid_elf (sym_absolute_path, elf_type))
+  for (const auto *dir_entry : entries)
     {
-      switch (elf_type)
-        {
-        case ET_EXEC:
-          {
-            fmt::print ("ET_EXEC: {}\n", sym_absolute_path);
-            this->file_infos_.emplace_back (std::make_tuple (
-                symbolic_path, utils::toUType(file_type::EXE), ::utils::md5 (sym_absolute_path)));
-            break;
-          }
-        case ET_DYN:
-          {
-            fmt::print ("ET_DYN: {}\n", sym_absolute_path);
-            this->file_infos_.emplace_back (std::make_tuple (
-                symbolic_path, utils::toUType(file_type::DYN), ::utils::md5 (sym_absolute_path)));
-            break;
-          }
-        case ET_NONE:
-          {
-            fmt::print ("ET_NONE: {}\n", sym_absolute_path);
-            break;
-          }
-        default:
-          {
-            fmt::print ("elf_type:{}, path: {}\n", elf_type, sym_absolute_path);
-            break;
-          }
-        }
+      classify_entry_ (listing, *dir_entry, tree, node, path, out);
     }
 }
 
-void
-scan_private::status_notifier ()
+std::shared_ptr<const result_cache::listing>
+scan_private::read_listing_ (dir_reader &dir)
 {
-  while (!is_scan_over ())
+  auto listing = std::make_shared<result_cache::listing> ();
+  if (cache_path_.empty ())
     {
-      std::this_thread::sleep_for(std::chrono::milliseconds(50));
-      if (false /*break*/)
+      traverse_dir_ (dir, *listing);
+      return listing;
+    }
+
+  file_stamp &dir_stamp = listing->stamp;
+  struct statx stx{};
+  if (::statx (dir.fd (), "", AT_EMPTY_PATH | AT_STATX_DONT_SYNC,
+               STATX_INO | STATX_SIZE | STATX_MTIME | STATX_CTIME, &stx) == 0)
+    {
+      dir_stamp = file_stamp::from_statx (stx);
+    }
+
+  if (dir_stamp.known ())
+    {
+      if (auto cached = cache_.lookup_listing (dir_stamp))
         {
-          stop ();
-          break;
+          // unchanged since the last scan, no getdents
+          return cached;
         }
     }
-  // if scan is over and not interrupted
-  if (true /*not interrupted*/)
+
+  if (!traverse_dir_ (dir, *listing) || !dir_stamp.known ())
     {
-      stop();
-      fmt::print("scan normally over!\n");
-      // notify finish scan operations
+      return listing;
     }
+
+  // a change within the same mtime tick as our read would go unseen,
+  // so a directory touched just now is listed again next time
+  const int64_t now_ns = std::chrono::duration_cast<std::chrono::nanoseconds> (
+                             std::chrono::system_clock::now ().time_since_epoch ())
+                             .count ();
+  constexpr int64_t RACY_WINDOW_NS = 2000000000;
+  if (now_ns - dir_stamp.mtime_ns > RACY_WINDOW_NS
+      && now_ns - dir_stamp.ctime_ns > RACY_WINDOW_NS)
+    {
+      cache_.store_listing (listing);
+    }
+  return listing;
 }
 
 bool
-scan_private::valid_path (std::string const &path)
+scan_private::traverse_dir_ (dir_reader &dir, result_cache::listing &out)
 {
+  utils::dir_entry dir_entry{};
+  while (dir.next (dir_entry))
+    {
+      if (!running_)
+        return false;
+
+      auto d_type = dir_entry.type;
+      if (d_type == DT_UNKNOWN)
+        {
+          // filesystem doesn't fill d_type (xfs without ftype, some
+          // fuse and network filesystems): the type is all we need
+          struct statx stx{};
+          if (::statx (dir.fd (), dir_entry.name, AT_SYMLINK_NOFOLLOW | AT_STATX_DONT_SYNC,
+                       STATX_TYPE, &stx) != 0
+              || !(stx.stx_mask & STATX_TYPE))
+            {
+              continue;
+            }
+          d_type = IFTODT (stx.stx_mode);
+        }
+
+      out.add (dir_entry.name, std::strlen (dir_entry.name), dir_entry.ino, d_type);
+    }
+
+  if (dir.error () != 0)
+    {
+      // todo: log
+      return false;
+    }
+  return true;
+}
+
+void
+scan_private::classify_entry_ (const result_cache::listing &listing,
+                               const result_cache::listing_entry &entry, path_tree &tree,
+                               const path_tree::node *node, std::string const &path,
+                               dir_entries &out)
+{
+  const char *name = listing.name_of (entry);
+  fmt::print("scanning: {}{}\n", path, name);
+
+  // if dir
+  if (entry.type == DT_DIR)
+    {
+      out.dirs.push_back (tree.add (node, { name, entry.name_size }));
+    }
+  else if (entry.type == DT_REG)
+    {
+      out.files.push_back (name);
+    }
+  else if (entry.type == DT_LNK)
+    {
+      out.symbols.push_back (name);
+    }
+}
+
+void
+scan_private::write_to_db_()
+{
+  // when force exit will drive worker thread join
+  // just wait and clear the filemap
+  record_batch local_file_infos;
+  std::vector<scan_record> records;
+  // asleep until a batch comes in, done once stop () closed the queue
+  while (next_batch_ (local_file_infos))
+    {
+      const size_t count = local_file_infos.size ();
+      if (handler_)
+        {
+          records.clear ();
+          records.resize (count);
+          for (size_t i = 0; i < count; ++i)
+            {
+              scan_record &record = records[i];
+              record.path = local_file_infos.path (i);
+              record.type = local_file_infos.type (i);
+              for (size_t algo = 0; algo < utils::DIGEST_ALGO_COUNT; ++algo)
+                {
+                  record.digests[algo] = local_file_infos.digest_hex (
+                      i, static_cast<utils::digest_algo> (algo));
+                }
+            }
+          handler_ (records);
+        }
+#ifdef HK_WITH_SQLITE
+      if (sink_)
+        {
+          sink_->write (local_file_infos);
+        }
+#endif
+      if (count == 0 && snapshot_due_.exchange (false))
+        {
+          if (!snapshot_.write (snapshot_path_, digests_))
+            {
+              fmt::print ("failed to write whitelist snapshot to {}\n", snapshot_path_);
+            }
+          snapshot_.clear ();
+          snapshot_written_ = true;
+        }
+      else if (!snapshot_path_.empty () && !snapshot_written_)
+        {
+          snapshot_.add (std::move (local_file_infos));
+        }
+      local_file_infos.clear ();
+      if (throttled_)
+        {
+          release_backlog_ (count);
+        }
+    }
+#ifdef HK_WITH_SQLITE
+  if (sink_)
+    {
+      sink_->close ();
+    }
+#endif
+}
+
+bool
+scan_private::next_batch_ (record_batch &batch)
+{
+#ifdef HK_WITH_SQLITE
+  // rows waiting for more company are committed when due even if none comes
+  while (sink_ && sink_->pending ())
+    {
+      if (file_infos_.wait_pop_until (batch, sink_->commit_deadline ()))
+        {
+          return true;
+        }
+      if (file_infos_.closed ())
+        {
+          return false;
+        }
+      sink_->flush ();
+    }
+#endif
+  return file_infos_.wait_pop (batch);
+}
+
+void
+scan_private::push_infos_ (file_info_batch &&infos)
+{
+  if (throttled_)
+    {
+      // one batch past the limit at most per producer: a directory's
+      // records aren't split
+      if (backlog_ >= max_backlog_)
+        {
+          ++backlog_waiters_;
+          std::unique_lock<std::mutex> lock (backlog_mutex_);
+          backlog_cv_.wait (lock, [this] { return backlog_ < max_backlog_ || backlog_closed_; });
+          --backlog_waiters_;
+        }
+      backlog_ += infos.size ();
+    }
+
+  size_t path_bytes = 0;
+  for (const auto &info : infos)
+    {
+      path_bytes += std::get<0> (info).size ();
+    }
+  record_batch batch (digests_);
+  batch.reserve (infos.size (), path_bytes);
+  for (const auto &info : infos)
+    {
+      batch.push (std::get<0> (info), static_cast<file_type> (std::get<1> (info)),
+                  std::get<2> (info));
+    }
+  infos.clear ();
+  file_infos_.push (std::move (batch));
+}
+
+void
+scan_private::release_backlog_ (size_t records)
+{
+  backlog_ -= records;
+  // seq_cst both ways: a producer counted after this load sees the new backlog
+  if (backlog_waiters_ > 0)
+    {
+      std::lock_guard<std::mutex> lock (backlog_mutex_);
+      backlog_cv_.notify_all ();
+    }
+}
+
+void
+scan_private::close_backlog_ ()
+{
+  std::lock_guard<std::mutex> lock (backlog_mutex_);
+  backlog_closed_ = true;
+  backlog_cv_.notify_all ();
+}
+
+void
+scan_private::hash_infos_ (int dirfd, size_t name_offset, file_info_batch &infos)
+{
+  if (digests_ == utils::digest_bit (utils::digest_algo::BLAKE3))
+    {
+      // blake3 alone is a tree: big files are hashed by the whole pool
+      split_large_files_ (dirfd, name_offset, infos);
+    }
+
+  // every record is `dir path + name`, symlinks included (openat follows them)
+  std::vector<utils::file_ref> files;
+  files.reserve (infos.size ());
+  for (const auto &info : infos)
+    {
+      files.push_back ({ dirfd, std::get<0> (info).c_str () + name_offset });
+    }
+
+  // one read per file whatever the algorithms, md5 alone goes multi-buffer
+  std::vector<utils::digest_set> digests;
+  utils::files_digests (files, digests_, digests);
+  for (size_t i = 0; i < infos.size (); ++i)
+    {
+      std::get<2> (infos[i]) = std::move (digests[i]);
+    }
+}
+
+void
+scan_private::split_large_files_ (int dirfd, size_t name_offset, file_info_batch &infos)
+{
+  auto keep = infos.begin ();
+  for (auto it = infos.begin (); it != infos.end (); ++it)
+    {
+      const char *name = std::get<0> (*it).c_str () + name_offset;
+      struct stat st{};
+      if (::fstatat (dirfd, name, &st, 0) == 0 && S_ISREG (st.st_mode)
+          && st.st_size >= TREE_HASH_MIN_SIZE)
+        {
+          auto job = std::make_shared<tree_hash_job> (
+              ::openat (dirfd, name, O_RDONLY | O_CLOEXEC | O_NOCTTY | O_NONBLOCK));
+          if (job->fd >= 0)
+            {
+              job->info = std::move (*it);
+              job->size = static_cast<uint64_t> (st.st_size);
+              // at least one byte is left to the tail: the root is never a segment
+              const size_t segments = (job->size - 1) / TREE_SEGMENT_SIZE;
+              job->cvs.resize (segments);
+              job->pending = segments;
+              for (size_t segment = 0; segment < segments; ++segment)
+                {
+                  io_queues_.push (st.st_dev, std::bind (&scan_private::hash_segment_,
+                                                         this, job, segment));
+                }
+              continue;
+            }
+        }
+
+      if (keep != it)
+        {
+          *keep = std::move (*it);
+        }
+      ++keep;
+    }
+  infos.erase (keep, infos.end ());
+}
+
+void
+scan_private::hash_segment_ (const std::shared_ptr<tree_hash_job> &job, size_t segment)
+{
+  auto &buffer = segment_buffer ();
+
+  if (!job->failed)
+    {
+      const ssize_t nread = read_at (job->fd, buffer.data (), TREE_SEGMENT_SIZE,
+                                     static_cast<off_t> (segment * TREE_SEGMENT_SIZE));
+      // hashing is all cpu, the next read can start
+      device_queues::release_slot ();
+      if (nread == static_cast<ssize_t> (TREE_SEGMENT_SIZE))
+        {
+          job->cvs[segment] = utils::blake3_hasher::subtree_cv (
+              buffer.data (), TREE_SEGMENT_CHUNKS, segment * TREE_SEGMENT_CHUNKS);
+        }
+      else
+        {
+          // unreadable or truncated under us
+          job->failed = true;
+        }
+    }
+
+  // the last segment done finishes the file
+  if (job->pending.fetch_sub (1) == 1)
+    {
+      finish_tree_ (*job);
+    }
+}
+
+void
+scan_private::finish_tree_ (tree_hash_job &job)
+{
+  utils::blake3_hasher hasher;
+  for (const auto &cv : job.cvs)
+    {
+      hasher.append_subtree (cv, TREE_SEGMENT_CHUNKS);
+    }
+
+  // the tail, read to the end of file rather than to the size seen at stat
+  auto &buffer = segment_buffer ();
+  off_t offset = static_cast<off_t> (job.cvs.size () * TREE_SEGMENT_SIZE);
+  bool tail_read = false;
+  while (!job.failed)
+    {
+      const ssize_t nread = read_at (job.fd, buffer.data (), buffer.size (), offset);
+      if (nread < 0)
+        {
+          job.failed = true;
+          break;
+        }
+      if (nread == 0)
+        {
+          break;
+        }
+      hasher.update (buffer.data (), static_cast<size_t> (nread));
+      offset += nread;
+      tail_read = true;
+    }
+
+  if (!job.failed && tail_read)
+    {
+      const auto digest = hasher.final ();
+      std::memcpy (std::get<2> (job.info).set (utils::digest_algo::BLAKE3), digest.data (),
+                   digest.size ());
+      cache_result_ (job.info);
+    }
+
+  file_info_batch out_infos{};
+  out_infos.emplace_back (std::move (job.info));
+  push_infos_ (std::move (out_infos));
+}
+
+bool
+scan_private::cached_result_ (const file_stamp &stamp, const std::string &path,
+                              file_info_batch &out_infos, file_info_batch &done_infos)
+{
+  result_cache::entry cached;
+  if (!stamp.known () || !cache_.lookup (stamp, cached))
+    {
+      return false;
+    }
+
+  if (cached.file_type == result_cache::NOT_ELF)
+    {
+      return true;
+    }
+
+  if ((cached.digests.present () & digests_) == digests_)
+    {
+      done_infos.emplace_back (
+          std::make_tuple (path, cached.file_type, cached.digests, stamp));
+    }
+  else
+    {
+      // classified already, but not with every digest asked for now
+      out_infos.emplace_back (
+          std::make_tuple (path, cached.file_type, utils::digest_set{}, stamp));
+    }
+  return true;
+}
+
+void
+scan_private::cache_result_ (const file_info &info)
+{
+  const auto &stamp = std::get<3> (info);
+  const auto &digests = std::get<2> (info);
+  if (cache_path_.empty () || !stamp.known ())
+    {
+      return;
+    }
+
+  // unreadable this time, try again next scan
+  if ((digests.present () & digests_) != digests_)
+    {
+      return;
+    }
+
+  result_cache::entry result;
+  result.stamp = stamp;
+  result.file_type = std::get<1> (info);
+  result.digests = digests;
+  cache_.store (result);
+}
+
+void
+scan_private::publish_infos_ (int dirfd, size_t name_offset, file_info_batch &out_infos,
+                              file_info_batch &done_infos)
+{
+  if (!out_infos.empty ())
+    {
+      hash_infos_ (dirfd, name_offset, out_infos);
+      for (const auto &info : out_infos)
+        {
+          cache_result_ (info);
+        }
+      std::move (out_infos.begin (), out_infos.end (), std::back_inserter (done_infos));
+    }
+  // nothing left to read, and the push may wait on the backlog
+  device_queues::release_slot ();
+
+  if (!done_infos.empty ())
+    {
+      push_infos_ (std::move (done_infos));
+    }
+}
+
+void
+scan_private::watch_changes_ ()
+{
+  std::vector<fs_event> events;
+  // changes are only counted while there is a cache to save them to
+  bool unsaved = false;
+  auto unsaved_since = std::chrono::steady_clock::now ();
+  int timeout_ms = -1;
+  while (running_ && watcher_.wait_events (events, timeout_ms))
+    {
+      // one look per path, however many events it got
+      std::unordered_map<std::string, uint64_t> changes;
+      bool overflow = false;
+      for (const auto &event : events)
+        {
+          if (event.path.empty ())
+            {
+              overflow = true;
+              continue;
+            }
+          changes[event.path] |= event.mask;
+        }
+      events.clear ();
+
+      if (overflow)
+        {
+          // events were dropped, only a walk can tell what changed
+          fmt::print ("fanotify queue overflow, rescanning\n");
+          const auto tree = std::make_shared<path_tree> ();
+          for (const auto &dir : unscanned_dirs_)
+            {
+              struct stat st{};
+              schedule_scan_ (tree, ::stat (dir.c_str (), &st) == 0 ? st.st_dev : 0, dir, {});
+            }
+        }
+
+      file_info_batch out_infos{};
+      file_info_batch done_infos{};
+      // the cache file may be on a watched filesystem: saving it is a
+      // change too, but not one to save again
+      bool changed = overflow;
+      for (const auto &change : changes)
+        {
+          changed = changed || under_roots_ (change.first);
+          handle_change_ (change.first, change.second, out_infos, done_infos);
+        }
+      // paths are absolute
+      publish_infos_ (AT_FDCWD, 0, out_infos, done_infos);
+
+      if (changed && !cache_path_.empty () && !unsaved)
+        {
+          unsaved = true;
+          unsaved_since = std::chrono::steady_clock::now ();
+        }
+
+      // saved a while after the first unsaved change, not on every one;
+      // rescans still in the pool are in the next save, or the one on stop
+      timeout_ms = -1;
+      if (unsaved)
+        {
+          const auto left
+              = unsaved_since + CACHE_SAVE_INTERVAL - std::chrono::steady_clock::now ();
+          if (left <= std::chrono::steady_clock::duration::zero ())
+            {
+              save_cache_ ();
+              unsaved = false;
+            }
+          else
+            {
+              timeout_ms = static_cast<int> (
+                  std::chrono::ceil<std::chrono::milliseconds> (left).count ());
+            }
+        }
+    }
+}
+
+bool
+scan_private::save_cache_ ()
+{
+  if (cache_path_.empty () || cache_.save (cache_path_))
+    {
+      return true;
+    }
+  fmt::print ("failed to save result cache to {}\n", cache_path_);
+  return false;
+}
+
+void
+scan_private::handle_change_ (const std::string &path, uint64_t mask,
+                              file_info_batch &out_infos, file_info_batch &done_infos)
+{
+  if (!under_roots_ (path) || !valid_path (path))
+    {
+      return;
+    }
+
+  // events only say where to look, what is there now decides
+  struct stat st{};
+  if (::lstat (path.c_str (), &st) != 0)
+    {
+      done_infos.emplace_back (std::make_tuple ((mask & FAN_ONDIR) ? path + '/' : path,
+                                                utils::toUType (file_type::REMOVED),
+                                                utils::digest_set{}, file_stamp{}));
+      return;
+    }
+
+  if (S_ISDIR (st.st_mode))
+    {
+      if (mask & (FAN_CREATE | FAN_MOVED_TO))
+        {
+          schedule_scan_ (std::make_shared<path_tree> (), st.st_dev, path + '/', {});
+        }
+      return;
+    }
+
+  if ((mask & ~FAN_ONDIR) == FAN_CREATE && S_ISREG (st.st_mode) && st.st_size == 0)
+    {
+      // still being written, FAN_CLOSE_WRITE follows
+      return;
+    }
+
+  const size_t infos_before = out_infos.size () + done_infos.size ();
+  if (S_ISREG (st.st_mode))
+    {
+      file_checker (AT_FDCWD, path.c_str (), path, out_infos, done_infos);
+    }
+  else if (S_ISLNK (st.st_mode))
+    {
+      symbol_reloader (path, out_infos, done_infos);
+    }
+
+  if (out_infos.size () + done_infos.size () == infos_before)
+    {
+      // not (or no longer) an elf
+      done_infos.emplace_back (std::make_tuple (path, utils::toUType (file_type::REMOVED),
+                                                utils::digest_set{}, file_stamp{}));
+    }
+}
+
+bool
+scan_private::under_roots_ (const std::string &path) const
+{
+  for (const auto &root : watched_roots_)
+    {
+      // the root itself comes without its '/'
+      if (path.compare (0, root.size (), root) == 0
+          || (path.size () + 1 == root.size () && root.compare (0, path.size (), path) == 0))
+        {
+          return true;
+        }
+    }
+  return false;
+}
+
+unsigned int
+scan_private::statx_mask_ (bool need_type) const
+{
+  unsigned int mask = STATX_SIZE;
+  if (need_type)
+    {
+      mask |= STATX_TYPE;
+    }
+  if (require_exec_bit_)
+    {
+      mask |= STATX_MODE;
+    }
+  if (!cache_path_.empty ())
+    {
+      mask |= STATX_INO | STATX_MTIME | STATX_CTIME;
+    }
+  return mask;
+}
+
+bool
+scan_private::may_be_elf_ (const struct statx &stx) const
+{
+  // fields the filesystem didn't return prove nothing either way
+  if ((stx.stx_mask & STATX_TYPE) && !S_ISREG (stx.stx_mode))
+    {
+      return false;
+    }
+  if ((stx.stx_mask & STATX_SIZE) && stx.stx_size < utils::ELF_MIN_FILE_SIZE)
+    {
+      return false;
+    }
+  if (require_exec_bit_ && (stx.stx_mask & STATX_MODE)
+      && (stx.stx_mode & (S_IXUSR | S_IXGRP | S_IXOTH)) == 0)
+    {
+      return false;
+    }
+  return true;
+}
+
+bool
+scan_private::screen_file_ (int dirfd, const char *name, const std::string &fullpath,
+                            file_stamp &stamp, file_info_batch &out_infos,
+                            file_info_batch &done_infos)
+{
+  // metadata first: most files are turned down here, before any open
+  struct statx stx{};
+  if (::statx (dirfd, name, AT_SYMLINK_NOFOLLOW | AT_STATX_DONT_SYNC, statx_mask_ (false),
+               &stx) != 0)
+    {
+      stx.stx_mask = 0;
+    }
+  return screen_statx_ (stx, fullpath, stamp, out_infos, done_infos);
+}
+
+bool
+scan_private::screen_statx_ (const struct statx &stx, const std::string &fullpath,
+                             file_stamp &stamp, file_info_batch &out_infos,
+                             file_info_batch &done_infos)
+{
+  if (!may_be_elf_ (stx))
+    {
+      return false;
+    }
+
+  stamp = file_stamp{};
+  if (!cache_path_.empty ())
+    {
+      if (stx.stx_mask & STATX_INO)
+        {
+          stamp = file_stamp::from_statx (stx);
+        }
+      if (cached_result_ (stamp, fullpath, out_infos, done_infos))
+        {
+          return false;
+        }
+    }
+  return true;
+}
+
+void
+scan_private::record_elf_ (int elf_type, const std::string &fullpath, const file_stamp &stamp,
+                           file_info_batch &out_infos)
+{
+  if (elf_type == utils::ELF_PROBE_UNREADABLE)
+    {
+      // not known to be anything: left out of the cache, the next scan looks again
+      fmt::print ("can't read {}\n", fullpath);
+      return;
+    }
+
+  switch (elf_type)
+    {
+    case ET_EXEC:
+      {
+        out_infos.emplace_back (std::make_tuple (
+            fullpath, utils::toUType(file_type::EXE), utils::digest_set{}, stamp));
+        return;
+      }
+    case ET_DYN:
+      {
+        out_infos.emplace_back (std::make_tuple (
+            fullpath, utils::toUType(file_type::DYN), utils::digest_set{}, stamp));
+        return;
+      }
+    case ET_NONE:
+    default:
+      break;
+    }
+
+  if (stamp.known ())
+    {
+      result_cache::entry result;
+      result.stamp = stamp;
+      cache_.store (result);
+    }
+}
+
+void
+scan_private::file_checker (int dirfd, const char *name, const std::string &fullpath,
+                            file_info_batch &out_infos, file_info_batch &done_infos)
+{
+  file_stamp stamp{};
+  if (!screen_file_ (dirfd, name, fullpath, stamp, out_infos, done_infos))
+    {
+      return;
+    }
+
+  int elf_type{};
+  if (!::utils::check_if_valid_elf (dirfd, name, elf_type))
+    {
+      elf_type = elf_type == utils::ELF_UNREADABLE ? utils::ELF_PROBE_UNREADABLE
+                                                   : utils::ELF_PROBE_INVALID;
+    }
+  record_elf_ (elf_type, fullpath, stamp, out_infos);
+}
+
+void
+scan_private::symbol_reloader (const std::string &symbolic_path,
+                               file_info_batch &out_infos, file_info_batch &done_infos)
+{
+  char sym_absolute_path[PATH_MAX] = { 0 };
+  if (::realpath (symbolic_path.c_str (), sym_absolute_path) == nullptr)
+    {
+      fmt::print ("no final target at symbol:{}, errno:{}\n", symbolic_path,
+                 errno);
+      return;
+    }
+  if (!valid_path (sym_absolute_path))
+    {
+      fmt::print ("skip symbol_path:{}\n", symbolic_path);
+      return;
+    }
+
+  struct statx stx{};
+  if (::statx (AT_FDCWD, sym_absolute_path, AT_STATX_DONT_SYNC, statx_mask_ (true), &stx) != 0)
+    {
+      stx.stx_mask = 0;
+    }
+  if (!may_be_elf_ (stx))
+    {
+      return;
+    }
+
+  // keyed on the target: the link and the file share one entry
+  file_stamp stamp{};
+  if (!cache_path_.empty ())
+    {
+      if (stx.stx_mask & STATX_INO)
+        {
+          stamp = file_stamp::from_statx (stx);
+        }
+      if (cached_result_ (stamp, symbolic_path, out_infos, done_infos))
+        {
+          return;
+        }
+    }
+
+  const size_t infos_before = out_infos.size ();
+  int elf_type{};
+  fmt::print ("symbol: {} => real path: {}\n", symbolic_path, sym_absolute_path);
+  if (::utils::check_if_valid_elf (sym_absolute_path, elf_type))
+    {
+      switch (elf_type)
+        {
+        case ET_EXEC:
+          {
+            fmt::print ("ET_EXEC: {}\n", sym_absolute_path);
+            out_infos.emplace_back (std::make_tuple (
+                symbolic_path, utils::toUType(file_type::EXE), utils::digest_set{}, stamp));
+            break;
+          }
+        case ET_DYN:
+          {
+            fmt::print ("ET_DYN: {}\n", sym_absolute_path);
+            out_infos.emplace_back (std::make_tuple (
+                symbolic_path, utils::toUType(file_type::DYN), utils::digest_set{}, stamp));
+            break;
+          }
+        case ET_NONE:
+          {
+            fmt::print ("ET_NONE: {}\n", sym_absolute_path);
+            break;
+          }
+        default:
+          {
+            fmt::print ("elf_type:{}, path: {}\n", elf_type, sym_absolute_path);
+            break;
+          }
+        }
+    }
+  else if (elf_type == utils::ELF_UNREADABLE)
+    {
+      fmt::print ("can't read {}\n", sym_absolute_path);
+    }
+
+  // a target that couldn't be read is looked at again next scan
+  if (stamp.known () && out_infos.size () == infos_before && elf_type != utils::ELF_UNREADABLE)
+    {
+      result_cache::entry result;
+      result.stamp = stamp;
+      cache_.store (result);
+    }
+}
+
+void
+scan_private::status_notifier ()
+{
+  // woken by this scan's last task, whatever else the pool runs;
+  // after stop () the tasks not started are dropped
+#ifdef HK_WITH_COROUTINES
+  coro_runner_.wait ();
+#endif
+  tasks_.wait ();
+  // continuous mode's trickle of changes says nothing about the devices
+  end_tuning_ ();
+  // no task is left holding a node of the initial scan
+  paths_.reset ();
+
+  // if scan is over and not interrupted
+  if (running_)
+    {
+      fmt::print("scan normally over!\n");
+      // an interrupted scan would forget everything it didn't reach
+      save_cache_ ();
+      if (!snapshot_path_.empty ())
+        {
+          // behind every record of the scan in the queue
+          snapshot_due_ = true;
+          file_infos_.push (record_batch{});
+        }
+      // notify finish scan operations
+
+      if (continuous_)
+        {
+          // keep the whitelist live until stop ()
+          watch_changes_ ();
+        }
+      stop();
+      if (continuous_)
+        {
+          // the rescans under way finish what they have started: the
+          // cache keeps all it had, plus whatever changed while watching
+          tasks_.wait ();
+          save_cache_ ();
+        }
+    }
+}
+
+void
+scan_private::tune_concurrency_ ()
+{
+  concurrency_tuner tuner (1, pool_->get_max_thread_count (), pool_->get_thread_count ());
+  int last_files = file_counts_;
+  auto last_totals = io_queues_.get_totals ();
+  auto last_time = std::chrono::steady_clock::now ();
+
+  std::unique_lock<std::mutex> lock (tuning_mutex_);
+  while (!tuning_cv_.wait_for (lock, TUNING_INTERVAL, [this] { return tuning_over_; }))
+    {
+      const auto now = std::chrono::steady_clock::now ();
+      const int files = file_counts_;
+      const auto totals = io_queues_.get_totals ();
+      const uint64_t tasks = totals.tasks - last_totals.tasks;
+      if (tasks == 0)
+        {
+          // nothing finished: a single long task, or the queues are empty
+          continue;
+        }
+
+      const double seconds = std::chrono::duration<double> (now - last_time).count ();
+      const double throughput = (files - last_files) / seconds;
+      const double latency = static_cast<double> (totals.busy_ns - last_totals.busy_ns) / tasks;
+      last_files = files;
+      last_totals = totals;
+      last_time = now;
+
+      const unsigned int threads = tuner.update (throughput, latency);
+      if (threads != pool_->get_thread_count ())
+        {
+          pool_->set_thread_count (threads);
+        }
+    }
+}
+
+void
+scan_private::end_tuning_ ()
+{
+  std::lock_guard<std::mutex> lock (tuning_mutex_);
+  tuning_over_ = true;
+  tuning_cv_.notify_all ();
+}
+
+bool
+scan_private::valid_dir_ (std::string const &dir)
+{
+  // only reached through a parent already let through, so
+  // just a mount point can change the answer: one lookup
+  if (mounts_.loaded ())
+    {
+      return !mounts_.skip_dir (dir);
+    }
+  return valid_path (dir);
+}
+
+bool
+scan_private::valid_path (std::string const &path)
+{
+  if (mounts_.loaded ())
+    {
+      return !mounts_.skip_path (path);
+    }
+
   return !std::any_of (skip_scanning_prefix.begin (),
                        skip_scanning_prefix.end (),
                        [&path] (std::string const &prefix) {
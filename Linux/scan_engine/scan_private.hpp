@@ -5,10 +5,28 @@
 #include <vector>
 #include <deque>
 #include <atomic>
+#include <memory>
+#include <condition_variable>
 #include <thread>
 
+#include <sys/stat.h>
+
 #include "utils/thread_pool.hpp"
 #include "utils/Thread.hpp"
+#include "utils/dir_reader.hpp"
+#include "utils/mpsc_queue.hpp"
+#include "utils/digest.hpp"
+
+#include "scan_def.hpp"
+
+#include "result_cache.hpp"
+#include "fs_watcher.hpp"
+#include "mount_planner.hpp"
+#include "device_queues.hpp"
+#include "path_tree.hpp"
+#include "record_batch.hpp"
+#include "snapshot_writer.hpp"
+#include "sqlite_sink.hpp"
 
 namespace scan
 {
@@ -18,14 +36,32 @@ namespace detail
 
 using utils::Thread;
 using utils::thread_pool;
+using utils::dir_reader;
+
+using file_info = std::tuple<std::string /*path*/, int /*file_type*/,
+                             utils::digest_set /*digests*/, file_stamp /*stamp*/>;
+// records of one do_scan call, handed to the recorder in one piece
+using file_info_batch = std::vector<file_info>;
 
 class scan_private
 {
 public:
   scan_private(unsigned int max_thread_hint);
+  explicit scan_private(std::shared_ptr<thread_pool> pool);
   ~scan_private();
 
   void set_path(const std::string& scan_path);
+  void set_digests(utils::digest_mask digests);
+  void set_cache_path(const std::string& cache_path);
+  void set_continuous(bool continuous);
+  void set_one_filesystem(bool one_filesystem);
+  void set_traversal(traversal_order order, bool inode_sorted);
+  void set_require_exec_bit(bool require_exec_bit);
+  void set_io_engine(io_engine engine);
+  void set_adaptive_concurrency(bool adaptive);
+  void set_result_handler(result_handler handler, size_t max_backlog);
+  void set_database_path(const std::string& db_path);
+  void set_snapshot_path(const std::string& snapshot_path);
 
   void launch();
   void wait();
@@ -36,30 +72,177 @@ public:
 
 private:
   bool valid_path (std::string const &path);
-  void do_scan (const std::string& curr_dir_path);
-  void file_checker(const std::string& fullpath);
-  void symbol_reloader(const std::string& symbolic_path);
-  void traverse_dir_ (std::string const &path, std::vector<std::string> &dirs,
-                      std::vector<std::string> &files, std::vector<std::string> &symbols);
+  bool valid_dir_ (std::string const &dir);
+  // a directory's entries by kind: subdirectories interned, file names
+  // pointing into the listing
+  struct dir_entries
+  {
+    std::shared_ptr<const result_cache::listing> listing;
+    std::vector<const path_tree::node *> dirs;
+    std::vector<const char *> files;
+    std::vector<const char *> symbols;
+  };
+
+  // nodes are `tree`'s, the tasks of a scan keep it alive
+  void do_scan (const std::shared_ptr<path_tree> &tree, const path_tree::node *curr_dir_node,
+                const std::shared_ptr<dir_reader>& parent_dir);
+  // CHECK_BATCH_SIZE files, or symlinks, from `begin`
+  void check_batch_ (const std::shared_ptr<dir_reader> &dir,
+                     const std::shared_ptr<path_tree> &tree, const path_tree::node *dir_node,
+                     const std::shared_ptr<const dir_entries> &entries, bool symbols,
+                     size_t begin);
+  void check_entries_ (int dirfd, const std::string &dir_path,
+                       const char *const *files, size_t file_count,
+                       const char *const *symbols, size_t symbol_count);
+  unsigned int statx_mask_ (bool need_type) const;
+  bool may_be_elf_ (const struct statx &stx) const;
+  // false if the file is turned down by metadata or answered by the cache
+  bool screen_file_ (int dirfd, const char *name, const std::string &fullpath,
+                     file_stamp &stamp, file_info_batch &out_infos,
+                     file_info_batch &done_infos);
+  bool screen_statx_ (const struct statx &stx, const std::string &fullpath,
+                      file_stamp &stamp, file_info_batch &out_infos,
+                      file_info_batch &done_infos);
+  void record_elf_ (int elf_type, const std::string &fullpath, const file_stamp &stamp,
+                    file_info_batch &out_infos);
+  void file_checker(int dirfd, const char* name, const std::string& fullpath,
+                    file_info_batch& out_infos, file_info_batch& done_infos);
+  void symbol_reloader(const std::string& symbolic_path, file_info_batch& out_infos,
+                       file_info_batch& done_infos);
+  bool cached_result_ (const file_stamp &stamp, const std::string &path,
+                       file_info_batch &out_infos, file_info_batch &done_infos);
+  void cache_result_ (const file_info &info);
+  void publish_infos_ (int dirfd, size_t name_offset, file_info_batch &out_infos,
+                       file_info_batch &done_infos);
+  void watch_changes_ ();
+  // no-op without a cache path, false if it couldn't be written
+  bool save_cache_ ();
+  void handle_change_ (const std::string &path, uint64_t mask,
+                       file_info_batch &out_infos, file_info_batch &done_infos);
+  bool under_roots_ (const std::string &path) const;
+  void hash_infos_ (int dirfd, size_t name_offset, file_info_batch &infos);
+
+  // large files hashed as a blake3 tree, one pool task per segment
+  struct tree_hash_job;
+  void split_large_files_ (int dirfd, size_t name_offset, file_info_batch &infos);
+  void hash_segment_ (const std::shared_ptr<tree_hash_job> &job, size_t segment);
+  void finish_tree_ (tree_hash_job &job);
+  // a scan root, as given, added to `tree`
+  void schedule_scan_ (const std::shared_ptr<path_tree> &tree, uint64_t dev,
+                       const std::string &dir, const std::shared_ptr<dir_reader> &parent_dir);
+  void schedule_scans_ (const std::shared_ptr<path_tree> &tree, uint64_t dev,
+                        const std::vector<const path_tree::node *> &dirs,
+                        const std::shared_ptr<dir_reader> &parent_dir);
+  std::unique_ptr<dir_reader> open_dir_ (const path_tree::node *node, const std::string &path,
+                                         const std::shared_ptr<dir_reader> &parent_dir);
+  std::shared_ptr<dir_reader> share_dir_ (std::unique_ptr<dir_reader> &dir);
+  void list_dir_ (dir_reader &dir, path_tree &tree, const path_tree::node *node,
+                  std::string const &path, dir_entries &out);
+  std::shared_ptr<const result_cache::listing> read_listing_ (dir_reader &dir);
+  bool traverse_dir_ (dir_reader &dir, result_cache::listing &out);
+  void classify_entry_ (const result_cache::listing &listing,
+                        const result_cache::listing_entry &entry, path_tree &tree,
+                        const path_tree::node *node, std::string const &path,
+                        dir_entries &out);
   void write_to_db_ ();
+  // the recorder's wait, cut short when the database has rows due
+  bool next_batch_ (record_batch &batch);
+  // producers of records hold off while the recorder is that far behind
+  void push_infos_ (file_info_batch &&infos);
+  void release_backlog_ (size_t records);
+  void close_backlog_ ();
   void status_notifier();
+  void tune_concurrency_ ();
+  void end_tuning_ ();
+
+#ifdef HK_WITH_COROUTINES
+  // the coroutine engine drives the same checks from its reactor thread
+  friend class coro_scan;
+  void run_coroutines_ ();
+#endif
 
 private:
+  // fallback when mountinfo can't be read
   std::vector<std::string> skip_scanning_prefix {"/sys", "/proc", "/dev", "/run", "/mnt"};
+  mount_planner mounts_;
+  traversal_order order_{ traversal_order::DFS };
+  bool inode_sorted_{};
+  bool require_exec_bit_{};
+  io_engine engine_{ io_engine::THREADS };
+  // the reactor still has coroutines alive
+  std::atomic_bool coro_running_{};
   std::atomic_bool running_{};
+  utils::digest_mask digests_{ utils::digest_bit (utils::digest_algo::MD5) };
+
+  // results of the last scan, empty path: no cache
+  std::string cache_path_;
+  result_cache cache_;
+
+  // continuous mode: changes after the initial scan, until stop()
+  bool continuous_{};
+  fs_watcher watcher_;
+  // the scan roots resolved and ending in '/': marks cover whole filesystems
+  std::vector<std::string> watched_roots_;
 
   std::mutex dir_mutex_;
   std::deque<std::string> unscanned_dirs_;
-
-  std::mutex file_info_mutex_;
-  std::vector<std::tuple<std::string /*path*/, int /*file_type*/,
-                         std::string /*md5*/> > file_infos_;
+  // every directory the initial scan enters, as parent and name; a
+  // rescan in continuous mode gets a tree of its own, gone with its tasks
+  std::shared_ptr<path_tree> paths_{ std::make_shared<path_tree> () };
+
+  // workers classify and hash lock-free, write_to_db_ is the only consumer;
+  // a directory's file_info_batch is packed on the way
+  utils::mpsc_queue<record_batch> file_infos_;
+
+  result_handler handler_;
+  // empty: not persisted
+  std::string db_path_;
+  // written once the initial scan is over, from what the recorder kept
+  // or spilled
+  std::string snapshot_path_;
+  snapshot_writer snapshot_;
+  // an empty batch asks the recorder to write it: all before it are in
+  std::atomic_bool snapshot_due_{};
+  bool snapshot_written_{};
+#ifdef HK_WITH_SQLITE
+  std::unique_ptr<sqlite_sink> sink_;
+#endif
+  // records queued and not yet handled or stored, pushes wait above
+  // max_backlog_ when someone consumes them
+  bool throttled_{};
+  size_t max_backlog_{};
+  std::atomic<size_t> backlog_{};
+  std::atomic<int> backlog_waiters_{};
+  bool backlog_closed_{};
+  std::mutex backlog_mutex_;
+  std::condition_variable backlog_cv_;
+
+  /* directory fds kept open for the children's openat, bounded by RLIMIT_NOFILE */
+  int max_shared_dir_fds_{};
+  std::atomic<int> shared_dir_fds_{};
+
+  // possibly shared with other scans: this one waits on its own group
+  std::shared_ptr<thread_pool> pool_;
+  // made for this scanner, not passed in
+  bool owns_pool_{};
+  utils::task_group tasks_;
+
+  // traversal and reads go through their device's queue
+  device_queues io_queues_;
+
+  // the pool's worker count follows the scan's throughput until it ends
+  bool adaptive_{};
+  bool tuning_over_{};
+  std::mutex tuning_mutex_;
+  std::condition_variable tuning_cv_;
 
   /* threads */
   Thread<scan_private> db_recorder_;
   Thread<scan_private> notifier_;
-  thread_pool task_pool_;
-
+  Thread<scan_private> tuner_;
+#ifdef HK_WITH_COROUTINES
+  Thread<scan_private> coro_runner_;
+#endif
 
   /* statistic info */
   std::atomic<int> file_counts_{};
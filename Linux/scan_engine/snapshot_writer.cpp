@@ -0,0 +1,476 @@
+#include "snapshot_writer.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <functional>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "utils/scoped_fd.hpp"
+
+#include "whitelist_snapshot.hpp"
+
+namespace scan
+{
+namespace detail
+{
+
+namespace
+{
+
+constexpr size_t COPY_CHUNK = 64 * 1024;
+
+void
+write_varint (std::string &out, uint64_t value)
+{
+  while (value >= 0x80)
+    {
+      out.push_back (static_cast<char> (value | 0x80));
+      value >>= 7;
+    }
+  out.push_back (static_cast<char> (value));
+}
+
+// false at the end of `in`
+bool
+read_varint (FILE *in, uint64_t &value)
+{
+  value = 0;
+  for (unsigned int shift = 0; shift < 64; shift += 7)
+    {
+      const int byte = std::getc (in);
+      if (byte == EOF)
+        {
+          return false;
+        }
+      value |= static_cast<uint64_t> (byte & 0x7f) << shift;
+      if (!(byte & 0x80))
+        {
+          return true;
+        }
+    }
+  return false;
+}
+
+uint64_t
+align_up (uint64_t offset)
+{
+  return (offset + sizeof (uint64_t) - 1) & ~(sizeof (uint64_t) - 1);
+}
+
+// the contents on disk before a rename publishes them
+bool
+sync_file (const std::string &path)
+{
+  usb::ScopedFd fd (::open (path.c_str (), O_RDONLY | O_CLOEXEC));
+  return fd >= 0 && ::fsync (fd) == 0;
+}
+
+// a record on its way to the snapshot, from a batch or back from a run
+struct snapshot_record
+{
+  std::string path;
+  file_type type{};
+  utils::digest_set digests;
+};
+
+void
+load_record (const record_batch &batch, size_t i, snapshot_record &out)
+{
+  const std::string_view path = batch.path (i);
+  out.path.assign (path.data (), path.size ());
+  out.type = batch.type (i);
+  out.digests.clear ();
+  for (size_t algo = 0; algo < utils::DIGEST_ALGO_COUNT; ++algo)
+    {
+      const auto which = static_cast<utils::digest_algo> (algo);
+      if (const uint8_t *digest = batch.digest (i, which))
+        {
+          std::memcpy (out.digests.set (which), digest, utils::digest_size (which));
+        }
+    }
+}
+
+// in a run: path size and path, type byte, digest_mask byte, the digests present
+bool
+write_record (FILE *run, const snapshot_record &record, std::string &scratch)
+{
+  scratch.clear ();
+  write_varint (scratch, record.path.size ());
+  scratch.append (record.path);
+  scratch.push_back (static_cast<char> (record.type));
+  scratch.push_back (static_cast<char> (record.digests.present ()));
+  for (size_t algo = 0; algo < utils::DIGEST_ALGO_COUNT; ++algo)
+    {
+      const auto which = static_cast<utils::digest_algo> (algo);
+      if (const uint8_t *digest = record.digests.get (which))
+        {
+          scratch.append (reinterpret_cast<const char *> (digest), utils::digest_size (which));
+        }
+    }
+  return std::fwrite (scratch.data (), 1, scratch.size (), run) == scratch.size ();
+}
+
+// false at the end of the run, or on an error: ferror tells
+bool
+read_record (FILE *run, snapshot_record &out)
+{
+  uint64_t size = 0;
+  if (!read_varint (run, size))
+    {
+      return false;
+    }
+  out.path.resize (size);
+  if (std::fread (&out.path[0], 1, size, run) != size)
+    {
+      return false;
+    }
+  const int type = std::getc (run);
+  const int present = std::getc (run);
+  if (type == EOF || present == EOF)
+    {
+      return false;
+    }
+  out.type = static_cast<file_type> (type);
+  out.digests.clear ();
+  for (size_t algo = 0; algo < utils::DIGEST_ALGO_COUNT; ++algo)
+    {
+      const auto which = static_cast<utils::digest_algo> (algo);
+      if ((present & (1u << algo))
+          && std::fread (out.digests.set (which), 1, utils::digest_size (which), run)
+                 != utils::digest_size (which))
+        {
+          return false;
+        }
+    }
+  return true;
+}
+
+/*
+ * The snapshot file, fed in path order. Rows go to the file as they
+ * come, right after the header; the path blocks wait in an unnamed
+ * file until the row count places them.
+ */
+class snapshot_output
+{
+public:
+  explicit snapshot_output (utils::digest_mask digests) : digests_{ digests }
+  {
+    for (size_t algo = 0; algo < utils::DIGEST_ALGO_COUNT; ++algo)
+      {
+        if (digests_ & (1u << algo))
+          {
+            row_size_ += utils::digest_size (static_cast<utils::digest_algo> (algo));
+          }
+      }
+  }
+  ~snapshot_output ()
+  {
+    if (paths_ != nullptr)
+      {
+        std::fclose (paths_);
+      }
+  }
+
+  snapshot_output (snapshot_output const &) = delete;
+  snapshot_output &operator= (snapshot_output const &) = delete;
+
+  bool
+  open (const std::string &path)
+  {
+    out_.open (path, std::ios::binary | std::ios::trunc);
+    paths_ = std::tmpfile ();
+    if (!out_ || paths_ == nullptr)
+      {
+        return false;
+      }
+    // the header is written last, once every offset is known
+    pad_to_ (align_up (sizeof (whitelist_snapshot::header)));
+    return static_cast<bool> (out_);
+  }
+
+  void
+  add (const snapshot_record &record)
+  {
+    row_.assign (row_size_, '\0');
+    row_[0] = static_cast<char> (record.type);
+    uint8_t present = 0;
+    size_t offset = 2;
+    for (size_t algo = 0; algo < utils::DIGEST_ALGO_COUNT; ++algo)
+      {
+        if (!(digests_ & (1u << algo)))
+          {
+            continue;
+          }
+        const auto which = static_cast<utils::digest_algo> (algo);
+        if (const uint8_t *digest = record.digests.get (which))
+          {
+            std::memcpy (&row_[offset], digest, utils::digest_size (which));
+            present |= static_cast<uint8_t> (1u << algo);
+          }
+        offset += utils::digest_size (which);
+      }
+    row_[1] = static_cast<char> (present);
+    out_.write (row_.data (), static_cast<std::streamsize> (row_.size ()));
+
+    encoded_.clear ();
+    if (count_ % whitelist_snapshot::BLOCK_SIZE == 0)
+      {
+        index_.push_back (paths_size_);
+        write_varint (encoded_, record.path.size ());
+        encoded_.append (record.path);
+      }
+    else
+      {
+        size_t shared = 0;
+        const size_t limit = std::min (previous_.size (), record.path.size ());
+        while (shared < limit && previous_[shared] == record.path[shared])
+          {
+            ++shared;
+          }
+        write_varint (encoded_, shared);
+        write_varint (encoded_, record.path.size () - shared);
+        encoded_.append (record.path, shared, std::string::npos);
+      }
+    std::fwrite (encoded_.data (), 1, encoded_.size (), paths_);
+    paths_size_ += encoded_.size ();
+    previous_ = record.path;
+    ++count_;
+  }
+
+  // the paths and the index after the rows, then the header
+  bool
+  finish ()
+  {
+    whitelist_snapshot::header head{};
+    std::memcpy (head.magic, whitelist_snapshot::MAGIC, sizeof (head.magic));
+    head.version = whitelist_snapshot::VERSION;
+    head.block_size = whitelist_snapshot::BLOCK_SIZE;
+    head.count = count_;
+    head.digests = digests_;
+    head.row_size = static_cast<uint32_t> (row_size_);
+    head.columns_offset = align_up (sizeof (head));
+    head.paths_offset = align_up (head.columns_offset + count_ * row_size_);
+    head.paths_size = paths_size_;
+    head.index_offset = align_up (head.paths_offset + paths_size_);
+    head.file_size = head.index_offset + index_.size () * sizeof (uint64_t);
+
+    if (std::fflush (paths_) != 0 || std::ferror (paths_))
+      {
+        return false;
+      }
+    pad_to_ (head.paths_offset);
+    std::rewind (paths_);
+    std::vector<char> buffer (COPY_CHUNK);
+    size_t nread;
+    while ((nread = std::fread (buffer.data (), 1, buffer.size (), paths_)) > 0)
+      {
+        out_.write (buffer.data (), static_cast<std::streamsize> (nread));
+      }
+    if (std::ferror (paths_))
+      {
+        return false;
+      }
+    pad_to_ (head.index_offset);
+    out_.write (reinterpret_cast<const char *> (index_.data ()),
+                static_cast<std::streamsize> (index_.size () * sizeof (uint64_t)));
+
+    out_.seekp (0);
+    out_.write (reinterpret_cast<const char *> (&head), sizeof (head));
+    out_.close ();
+    return !out_.fail ();
+  }
+
+private:
+  void
+  pad_to_ (uint64_t offset)
+  {
+    const std::streamoff at = out_.tellp ();
+    if (at >= 0 && static_cast<uint64_t> (at) < offset)
+      {
+        const char padding[sizeof (uint64_t)] = {};
+        out_.write (padding, static_cast<std::streamsize> (offset - static_cast<uint64_t> (at)));
+      }
+  }
+
+private:
+  utils::digest_mask digests_;
+  size_t row_size_{ 2 };
+  std::ofstream out_;
+  // path blocks, encoded
+  FILE *paths_{};
+  uint64_t paths_size_{};
+  std::vector<uint64_t> index_;
+  uint64_t count_{};
+  std::string previous_;
+  std::string row_;
+  std::string encoded_;
+};
+
+}
+
+void
+snapshot_writer::add (record_batch &&batch)
+{
+  if (batch.empty ())
+    {
+      return;
+    }
+  buffered_ += batch.bytes ();
+  batches_.push_back (std::move (batch));
+  if (buffered_ >= MAX_BUFFERED && !spill_ ())
+    {
+      // no room for a run: kept in memory, tried again MAX_BUFFERED later
+      buffered_ = 0;
+    }
+}
+
+void
+snapshot_writer::clear ()
+{
+  batches_.clear ();
+  buffered_ = 0;
+  runs_.clear ();
+}
+
+std::vector<snapshot_writer::record_ref>
+snapshot_writer::sorted_ () const
+{
+  std::vector<record_ref> order;
+  for (size_t b = 0; b < batches_.size (); ++b)
+    {
+      for (size_t i = 0; i < batches_[b].size (); ++i)
+        {
+          if (batches_[b].type (i) != file_type::REMOVED)
+            {
+              order.push_back ({ static_cast<uint32_t> (b), static_cast<uint32_t> (i) });
+            }
+        }
+    }
+  const auto path_of
+      = [this] (const record_ref &ref) { return batches_[ref.batch].path (ref.index); };
+  // stable: of equal paths the last added ends up last, and is kept
+  std::stable_sort (order.begin (), order.end (), [&] (const record_ref &lhs, const record_ref &rhs) {
+    return path_of (lhs) < path_of (rhs);
+  });
+  std::vector<record_ref> unique;
+  unique.reserve (order.size ());
+  for (size_t i = 0; i < order.size (); ++i)
+    {
+      if (i + 1 < order.size () && path_of (order[i]) == path_of (order[i + 1]))
+        {
+          continue;
+        }
+      unique.push_back (order[i]);
+    }
+  return unique;
+}
+
+bool
+snapshot_writer::spill_ ()
+{
+  file_ptr run (std::tmpfile ());
+  if (!run)
+    {
+      return false;
+    }
+  snapshot_record record;
+  std::string scratch;
+  for (const auto &ref : sorted_ ())
+    {
+      load_record (batches_[ref.batch], ref.index, record);
+      if (!write_record (run.get (), record, scratch))
+        {
+          return false;
+        }
+    }
+  if (std::fflush (run.get ()) != 0)
+    {
+      return false;
+    }
+  runs_.push_back (std::move (run));
+  batches_.clear ();
+  buffered_ = 0;
+  return true;
+}
+
+bool
+snapshot_writer::write (const std::string &path, utils::digest_mask digests)
+{
+  // each sorted and without duplicates: the runs oldest first, then what is buffered
+  std::vector<std::function<bool (snapshot_record &)>> sources;
+  for (const auto &run : runs_)
+    {
+      FILE *file = run.get ();
+      std::rewind (file);
+      sources.emplace_back ([file] (snapshot_record &out) { return read_record (file, out); });
+    }
+  const std::vector<record_ref> order = sorted_ ();
+  size_t next = 0;
+  sources.emplace_back ([&] (snapshot_record &out) {
+    if (next == order.size ())
+      {
+        return false;
+      }
+    load_record (batches_[order[next].batch], order[next].index, out);
+    ++next;
+    return true;
+  });
+
+  const std::string temp_path = path + ".tmp";
+  snapshot_output output (digests);
+  if (!output.open (temp_path))
+    {
+      std::remove (temp_path.c_str ());
+      return false;
+    }
+
+  // the smallest path of the sources' heads; of equal ones the newest source's
+  std::vector<snapshot_record> heads (sources.size ());
+  std::vector<bool> live (sources.size ());
+  for (size_t s = 0; s < sources.size (); ++s)
+    {
+      live[s] = sources[s] (heads[s]);
+    }
+  while (true)
+    {
+      size_t first = sources.size ();
+      for (size_t s = 0; s < sources.size (); ++s)
+        {
+          if (live[s] && (first == sources.size () || heads[s].path <= heads[first].path))
+            {
+              first = s;
+            }
+        }
+      if (first == sources.size ())
+        {
+          break;
+        }
+      output.add (heads[first]);
+      for (size_t s = 0; s < sources.size (); ++s)
+        {
+          if (s != first && live[s] && heads[s].path == heads[first].path)
+            {
+              live[s] = sources[s] (heads[s]);
+            }
+        }
+      live[first] = sources[first] (heads[first]);
+    }
+
+  // a run that stopped on an error rather than at its end
+  const bool runs_read = std::none_of (runs_.begin (), runs_.end (), [] (const file_ptr &run) {
+    return std::ferror (run.get ()) != 0;
+  });
+  if (!runs_read || !output.finish () || !sync_file (temp_path)
+      || std::rename (temp_path.c_str (), path.c_str ()) != 0)
+    {
+      std::remove (temp_path.c_str ());
+      return false;
+    }
+  return true;
+}
+
+}
+}
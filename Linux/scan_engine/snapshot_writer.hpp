@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "utils/digest.hpp"
+
+#include "record_batch.hpp"
+
+namespace scan
+{
+namespace detail
+{
+
+/*
+ * Collects the scan's record batches and writes them out sorted in the
+ * whitelist_snapshot format. Batches are kept as they are until they
+ * hold MAX_BUFFERED bytes, then sorted and spilled to an unnamed
+ * temporary file as a run; write() merges the runs with what is left.
+ * Memory stays bounded whatever the size of the scan.
+ */
+class snapshot_writer
+{
+public:
+  static constexpr size_t MAX_BUFFERED = 64 << 20;
+
+  // takes the batch over, REMOVED records are left out
+  void add (record_batch &&batch);
+  void clear ();
+
+  // written aside, synced and renamed over `path`; a path seen twice
+  // keeps its last record
+  bool write (const std::string &path, utils::digest_mask digests);
+
+private:
+  // a record, as its batch and its place in it
+  struct record_ref
+  {
+    uint32_t batch;
+    uint32_t index;
+  };
+  // the buffered records in path order, the last of equal paths only
+  std::vector<record_ref> sorted_ () const;
+  // the buffered records to a new run, false if it can't be written
+  bool spill_ ();
+
+  struct file_closer
+  {
+    void operator() (FILE *file) const { std::fclose (file); }
+  };
+  using file_ptr = std::unique_ptr<FILE, file_closer>;
+
+private:
+  std::vector<record_batch> batches_;
+  size_t buffered_{};
+  // oldest first, each sorted and without duplicates
+  std::vector<file_ptr> runs_;
+};
+
+}
+}
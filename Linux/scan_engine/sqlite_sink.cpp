@@ -0,0 +1,233 @@
+#include "sqlite_sink.hpp"
+
+#include <sqlite3.h>
+
+#include <fmt/core.h>
+
+namespace scan
+{
+namespace detail
+{
+
+namespace
+{
+
+constexpr const char *SCHEMA = "CREATE TABLE IF NOT EXISTS whitelist ("
+                               " path TEXT PRIMARY KEY NOT NULL,"
+                               " type INTEGER NOT NULL,"
+                               " md5 BLOB, sha256 BLOB, blake3 BLOB, xxh3 BLOB"
+                               ") WITHOUT ROWID";
+
+// columns 3.. follow digest_algo
+constexpr const char *UPSERT
+    = "INSERT OR REPLACE INTO whitelist (path, type, md5, sha256, blake3, xxh3)"
+      " VALUES (?1, ?2, ?3, ?4, ?5, ?6)";
+constexpr const char *REMOVE = "DELETE FROM whitelist WHERE path = ?1";
+// paths starting with `dir/`: from "dir/" up to "dir0", '0' follows '/'
+constexpr const char *REMOVE_TREE = "DELETE FROM whitelist WHERE path >= ?1 AND path < ?2";
+
+// a writer waiting on a reader's checkpoint, or another scan
+constexpr int BUSY_TIMEOUT_MS = 5000;
+
+}
+
+sqlite_sink::~sqlite_sink ()
+{
+  close ();
+}
+
+bool
+sqlite_sink::open (const std::string &path)
+{
+  if (sqlite3_open_v2 (path.c_str (), &db_,
+                       SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE | SQLITE_OPEN_NOMUTEX, nullptr)
+      != SQLITE_OK)
+    {
+      fmt::print ("can't open database {}: {}\n", path, sqlite3_errmsg (db_));
+      close ();
+      return false;
+    }
+  sqlite3_busy_timeout (db_, BUSY_TIMEOUT_MS);
+
+  // WAL: readers aren't blocked, NORMAL: no fsync per commit, only at checkpoints
+  if (!exec_ ("PRAGMA journal_mode=WAL") || !exec_ ("PRAGMA synchronous=NORMAL")
+      || !exec_ (SCHEMA) || !prepare_ (UPSERT, upsert_) || !prepare_ (REMOVE, remove_)
+      || !prepare_ (REMOVE_TREE, remove_tree_) || !prepare_ ("BEGIN", begin_stmt_)
+      || !prepare_ ("COMMIT", commit_stmt_))
+    {
+      close ();
+      return false;
+    }
+  return true;
+}
+
+void
+sqlite_sink::write (const record_batch &records)
+{
+  if (db_ == nullptr || records.empty ())
+    {
+      return;
+    }
+  // without a transaction every statement commits on its own
+  const bool grouped = rows_ != 0 || begin_ ();
+
+  std::string upper;
+  for (size_t i = 0; i < records.size (); ++i)
+    {
+      const auto path = records.path (i);
+      if (records.type (i) == file_type::REMOVED)
+        {
+          if (!path.empty () && path.back () == '/')
+            {
+              upper.assign (path.data (), path.size () - 1);
+              upper += '0';
+              sqlite3_bind_text (remove_tree_, 1, path.data (), static_cast<int> (path.size ()),
+                                 SQLITE_STATIC);
+              sqlite3_bind_text (remove_tree_, 2, upper.data (), static_cast<int> (upper.size ()),
+                                 SQLITE_STATIC);
+              step_ (remove_tree_);
+            }
+          else
+            {
+              sqlite3_bind_text (remove_, 1, path.data (), static_cast<int> (path.size ()),
+                                 SQLITE_STATIC);
+              step_ (remove_);
+            }
+          continue;
+        }
+
+      sqlite3_bind_text (upsert_, 1, path.data (), static_cast<int> (path.size ()),
+                         SQLITE_STATIC);
+      sqlite3_bind_int (upsert_, 2, static_cast<int> (records.type (i)));
+      for (size_t algo = 0; algo < utils::DIGEST_ALGO_COUNT; ++algo)
+        {
+          const auto which = static_cast<utils::digest_algo> (algo);
+          const int column = static_cast<int> (algo) + 3;
+          if (const uint8_t *digest = records.digest (i, which))
+            {
+              sqlite3_bind_blob (upsert_, column, digest,
+                                 static_cast<int> (utils::digest_size (which)), SQLITE_STATIC);
+            }
+          else
+            {
+              sqlite3_bind_null (upsert_, column);
+            }
+        }
+      step_ (upsert_);
+    }
+  if (!grouped)
+    {
+      return;
+    }
+  if (!in_transaction_ ())
+    {
+      // a failed statement (disk full, i/o error) rolled everything back
+      fmt::print ("database lost {} uncommitted rows\n", rows_ + records.size ());
+      rows_ = 0;
+      return;
+    }
+  rows_ += records.size ();
+
+  if (rows_ >= max_rows_ || std::chrono::steady_clock::now () - began_ >= max_delay_)
+    {
+      flush ();
+    }
+}
+
+bool
+sqlite_sink::flush ()
+{
+  if (db_ == nullptr || rows_ == 0)
+    {
+      return true;
+    }
+  if (step_ (commit_stmt_))
+    {
+      rows_ = 0;
+      return true;
+    }
+  if (!in_transaction_ ())
+    {
+      fmt::print ("database lost {} uncommitted rows\n", rows_);
+      rows_ = 0;
+      return false;
+    }
+  // still open, busy past the timeout most likely: due again after max_delay_
+  began_ = std::chrono::steady_clock::now ();
+  return false;
+}
+
+void
+sqlite_sink::close ()
+{
+  if (db_ != nullptr && !flush () && in_transaction_ ())
+    {
+      exec_ ("ROLLBACK");
+      fmt::print ("database lost {} uncommitted rows\n", rows_);
+      rows_ = 0;
+    }
+  for (sqlite3_stmt **stmt : { &upsert_, &remove_, &remove_tree_, &begin_stmt_, &commit_stmt_ })
+    {
+      sqlite3_finalize (*stmt);
+      *stmt = nullptr;
+    }
+  if (db_ != nullptr)
+    {
+      sqlite3_close (db_);
+      db_ = nullptr;
+    }
+}
+
+bool
+sqlite_sink::exec_ (const char *sql)
+{
+  char *error = nullptr;
+  if (sqlite3_exec (db_, sql, nullptr, nullptr, &error) != SQLITE_OK)
+    {
+      fmt::print ("database error on {}: {}\n", sql, error != nullptr ? error : "");
+      sqlite3_free (error);
+      return false;
+    }
+  return true;
+}
+
+bool
+sqlite_sink::prepare_ (const char *sql, sqlite3_stmt *&stmt)
+{
+  if (sqlite3_prepare_v3 (db_, sql, -1, SQLITE_PREPARE_PERSISTENT, &stmt, nullptr) != SQLITE_OK)
+    {
+      fmt::print ("database error on {}: {}\n", sql, sqlite3_errmsg (db_));
+      return false;
+    }
+  return true;
+}
+
+bool
+sqlite_sink::begin_ ()
+{
+  began_ = std::chrono::steady_clock::now ();
+  return step_ (begin_stmt_);
+}
+
+bool
+sqlite_sink::step_ (sqlite3_stmt *stmt)
+{
+  const bool done = sqlite3_step (stmt) == SQLITE_DONE;
+  if (!done)
+    {
+      // todo: log
+      fmt::print ("database error: {}\n", sqlite3_errmsg (db_));
+    }
+  sqlite3_reset (stmt);
+  sqlite3_clear_bindings (stmt);
+  return done;
+}
+
+bool
+sqlite_sink::in_transaction_ () const
+{
+  return sqlite3_get_autocommit (db_) == 0;
+}
+
+}
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <string>
+
+#include "record_batch.hpp"
+
+struct sqlite3;
+struct sqlite3_stmt;
+
+namespace scan
+{
+namespace detail
+{
+
+/*
+ * The whitelist in an SQLite file, table `whitelist` keyed on the path,
+ * digests as blobs. Rows go through prepared statements inside one
+ * transaction that is committed as a group: once it holds `max_rows`,
+ * once its first row is `max_delay` old, or when the caller sees no
+ * more records coming. The database is in WAL mode, so readers query
+ * it while a scan writes, and a commit costs a log append.
+ *
+ * One thread at a time.
+ */
+class sqlite_sink
+{
+public:
+  static constexpr size_t DEFAULT_MAX_ROWS = 50000;
+  static constexpr std::chrono::milliseconds DEFAULT_MAX_DELAY{ 500 };
+
+  explicit sqlite_sink (size_t max_rows = DEFAULT_MAX_ROWS,
+                        std::chrono::milliseconds max_delay = DEFAULT_MAX_DELAY)
+      : max_rows_{ max_rows }, max_delay_{ max_delay }
+  {
+  }
+  ~sqlite_sink ();
+
+  sqlite_sink (sqlite_sink const &) = delete;
+  sqlite_sink &operator= (sqlite_sink const &) = delete;
+
+  // creates the file and the table if needed
+  bool open (const std::string &path);
+  bool is_open () const { return db_ != nullptr; }
+
+  // REMOVED records delete their path, a directory's everything under it
+  void write (const record_batch &records);
+  // commits what is pending now, if anything; false if the commit
+  // failed, the rows then stay pending and are tried again when due
+  bool flush ();
+  bool pending () const { return rows_ != 0; }
+  // when the pending rows are due, if any
+  std::chrono::steady_clock::time_point commit_deadline () const { return began_ + max_delay_; }
+  void close ();
+
+private:
+  bool exec_ (const char *sql);
+  bool prepare_ (const char *sql, sqlite3_stmt *&stmt);
+  bool begin_ ();
+  bool step_ (sqlite3_stmt *stmt);
+  bool in_transaction_ () const;
+
+private:
+  size_t max_rows_;
+  std::chrono::milliseconds max_delay_;
+
+  sqlite3 *db_{};
+  sqlite3_stmt *upsert_{};
+  sqlite3_stmt *remove_{};
+  sqlite3_stmt *remove_tree_{};
+  sqlite3_stmt *begin_stmt_{};
+  sqlite3_stmt *commit_stmt_{};
+
+  // rows in the open transaction, and when it began
+  size_t rows_{};
+  std::chrono::steady_clock::time_point began_;
+};
+
+}
+}
@@ -0,0 +1,299 @@
+#include "whitelist_snapshot.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <utility>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "utils/digest.hpp"
+#include "utils/scoped_fd.hpp"
+
+namespace scan
+{
+
+namespace
+{
+
+// LEB128 within [pos, end), false past the end
+bool
+read_varint (const uint8_t *&pos, const uint8_t *end, uint64_t &value)
+{
+  value = 0;
+  for (unsigned int shift = 0; pos < end && shift < 64; shift += 7)
+    {
+      const uint8_t byte = *pos++;
+      value |= static_cast<uint64_t> (byte & 0x7f) << shift;
+      if (!(byte & 0x80))
+        {
+          return true;
+        }
+    }
+  return false;
+}
+
+size_t
+row_size_of (uint32_t digests)
+{
+  size_t size = 2;
+  for (size_t algo = 0; algo < utils::DIGEST_ALGO_COUNT; ++algo)
+    {
+      if (digests & (1u << algo))
+        {
+          size += utils::digest_size (static_cast<utils::digest_algo> (algo));
+        }
+    }
+  return size;
+}
+
+}
+
+whitelist_snapshot::~whitelist_snapshot ()
+{
+  close ();
+}
+
+whitelist_snapshot::whitelist_snapshot (whitelist_snapshot &&other) noexcept
+    : base_{ std::exchange (other.base_, nullptr) }, length_{ std::exchange (other.length_, 0) }
+{
+}
+
+whitelist_snapshot &
+whitelist_snapshot::operator= (whitelist_snapshot &&other) noexcept
+{
+  if (this != &other)
+    {
+      close ();
+      base_ = std::exchange (other.base_, nullptr);
+      length_ = std::exchange (other.length_, 0);
+    }
+  return *this;
+}
+
+bool
+whitelist_snapshot::open (const std::string &path)
+{
+  close ();
+  usb::ScopedFd fd (::open (path.c_str (), O_RDONLY | O_CLOEXEC));
+  struct stat st{};
+  if (fd < 0 || ::fstat (fd, &st) != 0
+      || static_cast<size_t> (st.st_size) < sizeof (header))
+    {
+      return false;
+    }
+
+  void *mapped = ::mmap (nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  if (mapped == MAP_FAILED)
+    {
+      return false;
+    }
+  base_ = static_cast<const uint8_t *> (mapped);
+  length_ = static_cast<size_t> (st.st_size);
+
+  // checked once here, lookups trust the offsets
+  const header &h = head ();
+  const uint64_t blocks = (h.count + BLOCK_SIZE - 1) / BLOCK_SIZE;
+  const bool valid
+      = std::memcmp (h.magic, MAGIC, sizeof (MAGIC)) == 0 && h.version == VERSION
+        && h.block_size == BLOCK_SIZE && h.file_size == length_
+        && (h.digests & ~((1u << utils::DIGEST_ALGO_COUNT) - 1)) == 0
+        && h.row_size == row_size_of (h.digests) && h.columns_offset >= sizeof (header)
+        && h.columns_offset <= length_ && h.count <= (length_ - h.columns_offset) / h.row_size
+        && h.paths_offset <= length_ && h.paths_size <= length_ - h.paths_offset
+        && h.index_offset % sizeof (uint64_t) == 0 && h.index_offset <= length_
+        && blocks <= (length_ - h.index_offset) / sizeof (uint64_t);
+  if (!valid)
+    {
+      close ();
+      return false;
+    }
+  return true;
+}
+
+void
+whitelist_snapshot::close ()
+{
+  if (base_ != nullptr)
+    {
+      ::munmap (const_cast<uint8_t *> (base_), length_);
+      base_ = nullptr;
+      length_ = 0;
+    }
+}
+
+size_t
+whitelist_snapshot::blocks_ () const
+{
+  return (head ().count + BLOCK_SIZE - 1) / BLOCK_SIZE;
+}
+
+std::string_view
+whitelist_snapshot::first_path_ (size_t block) const
+{
+  const header &h = head ();
+  const auto *index = reinterpret_cast<const uint64_t *> (base_ + h.index_offset);
+  const uint8_t *end = base_ + h.paths_offset + h.paths_size;
+  const uint8_t *pos = base_ + h.paths_offset + std::min<uint64_t> (index[block], h.paths_size);
+  uint64_t size = 0;
+  if (!read_varint (pos, end, size) || size > static_cast<uint64_t> (end - pos))
+    {
+      return {};
+    }
+  return { reinterpret_cast<const char *> (pos), static_cast<size_t> (size) };
+}
+
+bool
+whitelist_snapshot::next_path_ (const uint8_t *&pos, std::string &current) const
+{
+  const header &h = head ();
+  const uint8_t *end = base_ + h.paths_offset + h.paths_size;
+  uint64_t shared = 0;
+  uint64_t rest = 0;
+  if (!read_varint (pos, end, shared) || !read_varint (pos, end, rest)
+      || shared > current.size () || rest > static_cast<uint64_t> (end - pos))
+    {
+      return false;
+    }
+  current.resize (shared);
+  current.append (reinterpret_cast<const char *> (pos), rest);
+  pos += rest;
+  return true;
+}
+
+bool
+whitelist_snapshot::decode_ (size_t block, size_t last, std::string &out) const
+{
+  const std::string_view first = first_path_ (block);
+  out.assign (first.data (), first.size ());
+  const uint8_t *pos = reinterpret_cast<const uint8_t *> (first.data ()) + first.size ();
+  for (size_t i = 1; i <= last; ++i)
+    {
+      if (!next_path_ (pos, out))
+        {
+          return false;
+        }
+    }
+  return true;
+}
+
+size_t
+whitelist_snapshot::find (std::string_view path) const
+{
+  if (size () == 0)
+    {
+      return npos;
+    }
+
+  // the last block starting at or before `path`
+  size_t low = 0;
+  size_t high = blocks_ ();
+  while (high - low > 1)
+    {
+      const size_t middle = low + (high - low) / 2;
+      if (first_path_ (middle) <= path)
+        {
+          low = middle;
+        }
+      else
+        {
+          high = middle;
+        }
+    }
+
+  const std::string_view first = first_path_ (low);
+  if (first == path)
+    {
+      return low * BLOCK_SIZE;
+    }
+  if (first > path)
+    {
+      return npos;
+    }
+
+  // sorted: decode until `path` or past it
+  std::string current (first);
+  const uint8_t *pos = reinterpret_cast<const uint8_t *> (first.data ()) + first.size ();
+  const size_t count = std::min<size_t> (BLOCK_SIZE, head ().count - low * BLOCK_SIZE);
+  for (size_t i = 1; i < count; ++i)
+    {
+      if (!next_path_ (pos, current))
+        {
+          return npos;
+        }
+      const int order = std::string_view (current).compare (path);
+      if (order == 0)
+        {
+          return low * BLOCK_SIZE + i;
+        }
+      if (order > 0)
+        {
+          break;
+        }
+    }
+  return npos;
+}
+
+std::string
+whitelist_snapshot::path (size_t i) const
+{
+  std::string out;
+  if (i >= size () || !decode_ (i / BLOCK_SIZE, i % BLOCK_SIZE, out))
+    {
+      return {};
+    }
+  return out;
+}
+
+const uint8_t *
+whitelist_snapshot::row_ (size_t i) const
+{
+  return base_ + head ().columns_offset + i * head ().row_size;
+}
+
+file_type
+whitelist_snapshot::type (size_t i) const
+{
+  if (i >= size ())
+    {
+      return file_type::REMOVED;
+    }
+  return static_cast<file_type> (row_ (i)[0]);
+}
+
+const uint8_t *
+whitelist_snapshot::digest (size_t i, digest_type type) const
+{
+  const uint32_t bit = static_cast<uint32_t> (type);
+  if (i >= size ())
+    {
+      return nullptr;
+    }
+  const header &h = head ();
+  const uint8_t *row = row_ (i);
+  if (!(h.digests & bit) || !(row[1] & bit))
+    {
+      return nullptr;
+    }
+  // slots of the algorithms before this one come first
+  size_t offset = 2;
+  for (size_t algo = 0; (1u << algo) < bit; ++algo)
+    {
+      if (h.digests & (1u << algo))
+        {
+          offset += utils::digest_size (static_cast<utils::digest_algo> (algo));
+        }
+    }
+  return row + offset;
+}
+
+size_t
+whitelist_snapshot::digest_size (digest_type type)
+{
+  return utils::digest_size (
+      static_cast<utils::digest_algo> (__builtin_ctz (static_cast<unsigned int> (type))));
+}
+
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+#include "scan_def.hpp"
+
+namespace scan
+{
+
+/*
+ * Reads the whitelist snapshot a scanner writes with set_snapshot_path().
+ * The file is mapped read-only and queried in place: opening it costs
+ * the same whatever its size, and every process mapping it shares one
+ * copy in the page cache.
+ *
+ * Layout, host byte order, each section 8-byte aligned:
+ *   header   magic, version, record count, digests, section offsets
+ *   columns  a fixed-size row per record, in path order: file_type
+ *            byte, digest presence byte, then one slot per digest of
+ *            the header's mask, in digest_type bit order
+ *   paths    sorted, in blocks of BLOCK_SIZE: a block's first path
+ *            whole, the next ones as the length they share with the
+ *            previous and the rest, lengths as varints
+ *   index    the offset in paths of every block
+ *
+ * A lookup bisects the blocks on their first paths, then decodes one.
+ */
+class whitelist_snapshot
+{
+public:
+  static constexpr char MAGIC[8] = { 'H', 'K', 'W', 'L', 'S', 'N', 'A', 'P' };
+  static constexpr uint32_t VERSION = 1;
+  static constexpr uint32_t BLOCK_SIZE = 16;
+  static constexpr size_t npos = static_cast<size_t> (-1);
+
+  struct header
+  {
+    char magic[8];
+    uint32_t version;
+    uint32_t block_size;
+    uint64_t count;
+    // digest_type bits of the columns
+    uint32_t digests;
+    uint32_t row_size;
+    uint64_t columns_offset;
+    uint64_t paths_offset;
+    uint64_t paths_size;
+    uint64_t index_offset;
+    uint64_t file_size;
+  };
+
+  whitelist_snapshot () = default;
+  ~whitelist_snapshot ();
+
+  whitelist_snapshot (whitelist_snapshot &&other) noexcept;
+  whitelist_snapshot &operator= (whitelist_snapshot &&other) noexcept;
+  whitelist_snapshot (whitelist_snapshot const &) = delete;
+  whitelist_snapshot &operator= (whitelist_snapshot const &) = delete;
+
+  // false, with nothing mapped, if the file is missing or not a snapshot
+  bool open (const std::string &path);
+  void close ();
+  bool is_open () const { return base_ != nullptr; }
+
+  size_t size () const { return is_open () ? head ().count : 0; }
+  // position of `path` in path order, npos if it isn't whitelisted
+  size_t find (std::string_view path) const;
+  bool contains (std::string_view path) const { return find (path) != npos; }
+
+  // empty if i is out of range
+  std::string path (size_t i) const;
+  // REMOVED, never stored, if i is out of range
+  file_type type (size_t i) const;
+  // digest_size (type) bytes, nullptr if the scan didn't compute it or
+  // i is out of range
+  const uint8_t *digest (size_t i, digest_type type) const;
+  static size_t digest_size (digest_type type);
+
+private:
+  const header &head () const { return *reinterpret_cast<const header *> (base_); }
+  size_t blocks_ () const;
+  // a block's first path, empty if the file is damaged there
+  std::string_view first_path_ (size_t block) const;
+  // the path after `current`, read at `pos`
+  bool next_path_ (const uint8_t *&pos, std::string &current) const;
+  // decodes block `block` up to and including its `last`-th path into `out`
+  bool decode_ (size_t block, size_t last, std::string &out) const;
+  const uint8_t *row_ (size_t i) const;
+
+private:
+  const uint8_t *base_{};
+  size_t length_{};
+};
+
+}
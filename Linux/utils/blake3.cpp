@@ -0,0 +1,292 @@
+#include "blake3.hpp"
+
+#include <cstring>
+
+namespace utils
+{
+namespace
+{
+
+constexpr uint32_t IV[8] = { 0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+                             0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19 };
+
+constexpr uint8_t MSG_PERMUTATION[16] = { 2, 6, 3, 10, 7, 0, 4, 13,
+                                          1, 11, 12, 5, 9, 14, 15, 8 };
+
+// domain flags, plain constants so conditionals over them stay uint32_t
+constexpr uint32_t CHUNK_START = 1 << 0;
+constexpr uint32_t CHUNK_END = 1 << 1;
+constexpr uint32_t PARENT = 1 << 2;
+constexpr uint32_t ROOT = 1 << 3;
+
+using chaining_value = blake3_hasher::chaining_value;
+
+inline uint32_t rotr32 (uint32_t x, int s) { return (x >> s) | (x << (32 - s)); }
+
+inline uint32_t
+load_le32 (const uint8_t *p)
+{
+  return static_cast<uint32_t> (p[0]) | static_cast<uint32_t> (p[1]) << 8
+         | static_cast<uint32_t> (p[2]) << 16 | static_cast<uint32_t> (p[3]) << 24;
+}
+
+inline void
+store_le32 (uint8_t *p, uint32_t v)
+{
+  p[0] = static_cast<uint8_t> (v);
+  p[1] = static_cast<uint8_t> (v >> 8);
+  p[2] = static_cast<uint8_t> (v >> 16);
+  p[3] = static_cast<uint8_t> (v >> 24);
+}
+
+inline void
+g (uint32_t s[16], int a, int b, int c, int d, uint32_t mx, uint32_t my)
+{
+  s[a] = s[a] + s[b] + mx;
+  s[d] = rotr32 (s[d] ^ s[a], 16);
+  s[c] = s[c] + s[d];
+  s[b] = rotr32 (s[b] ^ s[c], 12);
+  s[a] = s[a] + s[b] + my;
+  s[d] = rotr32 (s[d] ^ s[a], 8);
+  s[c] = s[c] + s[d];
+  s[b] = rotr32 (s[b] ^ s[c], 7);
+}
+
+inline void
+round_fn (uint32_t s[16], const uint32_t m[16])
+{
+  // columns
+  g (s, 0, 4, 8, 12, m[0], m[1]);
+  g (s, 1, 5, 9, 13, m[2], m[3]);
+  g (s, 2, 6, 10, 14, m[4], m[5]);
+  g (s, 3, 7, 11, 15, m[6], m[7]);
+  // diagonals
+  g (s, 0, 5, 10, 15, m[8], m[9]);
+  g (s, 1, 6, 11, 12, m[10], m[11]);
+  g (s, 2, 7, 8, 13, m[12], m[13]);
+  g (s, 3, 4, 9, 14, m[14], m[15]);
+}
+
+chaining_value
+compress (const chaining_value &cv, const uint8_t block[64], uint8_t block_len,
+          uint64_t counter, uint32_t flags)
+{
+  uint32_t m[16];
+  for (int i = 0; i < 16; ++i)
+    {
+      m[i] = load_le32 (block + 4 * i);
+    }
+
+  uint32_t s[16] = {
+    cv[0], cv[1], cv[2], cv[3], cv[4], cv[5], cv[6], cv[7],
+    IV[0], IV[1], IV[2], IV[3],
+    static_cast<uint32_t> (counter), static_cast<uint32_t> (counter >> 32),
+    block_len, flags,
+  };
+
+  for (int r = 0; r < 7; ++r)
+    {
+      round_fn (s, m);
+      if (r < 6)
+        {
+          uint32_t permuted[16];
+          for (int i = 0; i < 16; ++i)
+            {
+              permuted[i] = m[MSG_PERMUTATION[i]];
+            }
+          std::memcpy (m, permuted, sizeof (m));
+        }
+    }
+
+  // only the chaining value half is needed for a 32-byte digest
+  chaining_value out;
+  for (int i = 0; i < 8; ++i)
+    {
+      out[i] = s[i] ^ s[i + 8];
+    }
+  return out;
+}
+
+// a node not compressed yet: it becomes the root or a chaining value
+struct output_node
+{
+  chaining_value cv;
+  uint8_t block[64];
+  uint8_t block_len;
+  uint64_t counter;
+  uint32_t flags;
+
+  chaining_value
+  chaining () const
+  {
+    return compress (cv, block, block_len, counter, flags);
+  }
+};
+
+output_node
+chunk_output (const chaining_value &cv, const uint8_t block[64], uint8_t block_len,
+              uint64_t counter, uint8_t blocks_compressed)
+{
+  output_node node;
+  node.cv = cv;
+  std::memcpy (node.block, block, sizeof (node.block));
+  node.block_len = block_len;
+  node.counter = counter;
+  node.flags = CHUNK_END | (blocks_compressed == 0 ? CHUNK_START : 0u);
+  return node;
+}
+
+output_node
+parent_node (const chaining_value &left, const chaining_value &right)
+{
+  output_node node;
+  node.cv = { IV[0], IV[1], IV[2], IV[3], IV[4], IV[5], IV[6], IV[7] };
+  for (int i = 0; i < 8; ++i)
+    {
+      store_le32 (node.block + 4 * i, left[i]);
+      store_le32 (node.block + 32 + 4 * i, right[i]);
+    }
+  node.block_len = 64;
+  node.counter = 0;
+  node.flags = PARENT;
+  return node;
+}
+
+} // namespace
+
+void
+blake3_hasher::chunk_state::reset (uint64_t chunk_counter)
+{
+  cv = { IV[0], IV[1], IV[2], IV[3], IV[4], IV[5], IV[6], IV[7] };
+  counter = chunk_counter;
+  std::memset (block, 0, sizeof (block));
+  block_len = 0;
+  blocks_compressed = 0;
+}
+
+size_t
+blake3_hasher::chunk_state::len () const
+{
+  return BLOCK_LEN * blocks_compressed + block_len;
+}
+
+void
+blake3_hasher::chunk_state::update (const uint8_t *input, size_t size)
+{
+  while (size > 0)
+    {
+      // a full block is only compressed once more input shows it isn't the last
+      if (block_len == BLOCK_LEN)
+        {
+          cv = compress (cv, block, BLOCK_LEN, counter,
+                         blocks_compressed == 0 ? CHUNK_START : 0u);
+          ++blocks_compressed;
+          std::memset (block, 0, sizeof (block));
+          block_len = 0;
+        }
+
+      const size_t take = size < BLOCK_LEN - block_len ? size : BLOCK_LEN - block_len;
+      std::memcpy (block + block_len, input, take);
+      block_len = static_cast<uint8_t> (block_len + take);
+      input += take;
+      size -= take;
+    }
+}
+
+void
+blake3_hasher::reset ()
+{
+  chunk_.reset (0);
+  cv_stack_len_ = 0;
+}
+
+void
+blake3_hasher::push_cv (chaining_value cv, uint64_t total_units)
+{
+  // totals count subtrees of the pushed one's size, each trailing
+  // zero bit closes one complete subtree of twice that size
+  while ((total_units & 1) == 0)
+    {
+      cv = parent_node (cv_stack_[--cv_stack_len_], cv).chaining ();
+      total_units >>= 1;
+    }
+  cv_stack_[cv_stack_len_++] = cv;
+}
+
+void
+blake3_hasher::update (const void *data, size_t size)
+{
+  const auto *input = static_cast<const uint8_t *> (data);
+  while (size > 0)
+    {
+      // a full chunk is only finished once more input shows it isn't the last
+      if (chunk_.len () == CHUNK_LEN)
+        {
+          const uint64_t total_chunks = chunk_.counter + 1;
+          push_cv (chunk_output (chunk_.cv, chunk_.block, chunk_.block_len,
+                                       chunk_.counter, chunk_.blocks_compressed)
+                             .chaining (),
+                         total_chunks);
+          chunk_.reset (total_chunks);
+        }
+
+      const size_t take
+          = size < CHUNK_LEN - chunk_.len () ? size : CHUNK_LEN - chunk_.len ();
+      chunk_.update (input, take);
+      input += take;
+      size -= take;
+    }
+}
+
+blake3_hasher::chaining_value
+blake3_hasher::subtree_cv (const void *data, uint64_t chunks, uint64_t chunk_counter)
+{
+  const auto *input = static_cast<const uint8_t *> (data);
+  if (chunks == 1)
+    {
+      chunk_state chunk;
+      chunk.reset (chunk_counter);
+      chunk.update (input, CHUNK_LEN);
+      return chunk_output (chunk.cv, chunk.block, chunk.block_len, chunk.counter,
+                           chunk.blocks_compressed)
+          .chaining ();
+    }
+
+  const uint64_t half = chunks / 2;
+  return parent_node (subtree_cv (input, half, chunk_counter),
+                      subtree_cv (input + half * CHUNK_LEN, half, chunk_counter + half))
+      .chaining ();
+}
+
+void
+blake3_hasher::append_subtree (const chaining_value &cv, uint64_t chunks)
+{
+  const uint64_t total_chunks = chunk_.counter + chunks;
+  push_cv (cv, total_chunks / chunks);
+  chunk_.reset (total_chunks);
+}
+
+blake3_digest
+blake3_hasher::final ()
+{
+  output_node node = chunk_output (chunk_.cv, chunk_.block, chunk_.block_len,
+                                   chunk_.counter, chunk_.blocks_compressed);
+
+  for (size_t level = cv_stack_len_; level > 0; --level)
+    {
+      node = parent_node (cv_stack_[level - 1], node.chaining ());
+    }
+
+  const chaining_value root
+      = compress (node.cv, node.block, node.block_len, node.counter, node.flags | ROOT);
+
+  blake3_digest digest;
+  for (int i = 0; i < 8; ++i)
+    {
+      store_le32 (digest.data () + 4 * i, root[i]);
+    }
+  reset ();
+  return digest;
+}
+
+} // namespace utils
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+namespace utils
+{
+
+using blake3_digest = std::array<uint8_t, 32>;
+
+/*
+ * Streaming BLAKE3 (default hash mode, 32-byte output), portable
+ * implementation of the reference algorithm: 1 KiB chunks, each compressed
+ * into a chaining value, merged pairwise into a binary tree whose shape
+ * only depends on the input length.
+ */
+class blake3_hasher
+{
+public:
+  static constexpr size_t CHUNK_LEN = 1024;
+  static constexpr size_t BLOCK_LEN = 64;
+
+  using chaining_value = std::array<uint32_t, 8>;
+
+  blake3_hasher () { reset (); }
+
+  void reset ();
+  void update (const void *data, size_t size);
+  blake3_digest final ();
+
+  /*
+   * Tree mode, to spread one input over several threads: subtree_cv hashes
+   * `chunks` full chunks (a power of two) starting at chunk `chunk_counter`,
+   * append_subtree feeds the result back in input order. Appending needs
+   * the hasher on a boundary aligned to `chunks`, and more input must
+   * follow before final(): the root is never a subtree.
+   */
+  static chaining_value subtree_cv (const void *data, uint64_t chunks,
+                                    uint64_t chunk_counter);
+  void append_subtree (const chaining_value &cv, uint64_t chunks);
+
+private:
+  struct chunk_state
+  {
+    chaining_value cv;
+    uint64_t counter;
+    uint8_t block[BLOCK_LEN];
+    uint8_t block_len;
+    uint8_t blocks_compressed;
+
+    void reset (uint64_t chunk_counter);
+    size_t len () const;
+    void update (const uint8_t *input, size_t size);
+  };
+
+  void push_cv (chaining_value cv, uint64_t total_units);
+
+private:
+  chunk_state chunk_;
+  // one entry per level of the tree, enough for 2^54 chunks
+  chaining_value cv_stack_[54];
+  uint8_t cv_stack_len_;
+};
+
+} // namespace utils
@@ -0,0 +1,169 @@
+#include "digest.hpp"
+
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstring>
+
+#include "blake3.hpp"
+#include "scoped_fd.hpp"
+#include "sha256.hpp"
+#include "xxh3.hpp"
+
+namespace utils
+{
+namespace
+{
+
+constexpr size_t READ_CHUNK = 64 * 1024;
+
+static_assert (digest_size (digest_algo::MD5) == std::tuple_size<md5_digest>::value, "md5 size");
+static_assert (digest_size (digest_algo::SHA256) == std::tuple_size<sha256_digest>::value,
+               "sha256 size");
+static_assert (digest_size (digest_algo::BLAKE3) == std::tuple_size<blake3_digest>::value,
+               "blake3 size");
+static_assert (digest_size (digest_algo::XXH3) == std::tuple_size<xxh3_digest>::value,
+               "xxh3 size");
+
+template <typename Context>
+class hasher_impl final : public hasher
+{
+public:
+  void
+  update (const void *data, size_t size) override
+  {
+    context_.update (data, size);
+  }
+
+  void
+  final (uint8_t *out) override
+  {
+    const auto digest = context_.final ();
+    std::memcpy (out, digest.data (), digest.size ());
+  }
+
+private:
+  Context context_;
+};
+
+} // namespace
+
+const char *
+digest_name (digest_algo algo)
+{
+  switch (algo)
+    {
+    case digest_algo::MD5:
+      return "md5";
+    case digest_algo::SHA256:
+      return "sha256";
+    case digest_algo::BLAKE3:
+      return "blake3";
+    case digest_algo::XXH3:
+      return "xxh3";
+    }
+  return "unknown";
+}
+
+std::unique_ptr<hasher>
+make_hasher (digest_algo algo)
+{
+  switch (algo)
+    {
+    case digest_algo::MD5:
+      return std::make_unique<hasher_impl<md5_context>> ();
+    case digest_algo::SHA256:
+      return std::make_unique<hasher_impl<sha256_context>> ();
+    case digest_algo::BLAKE3:
+      return std::make_unique<hasher_impl<blake3_hasher>> ();
+    case digest_algo::XXH3:
+      return std::make_unique<hasher_impl<xxh3_context>> ();
+    }
+  return nullptr;
+}
+
+bool
+file_digests (const file_ref &file, digest_mask algos, digest_set &digests)
+{
+  digests.clear ();
+
+  usb::ScopedFd fd (::openat (file.dirfd, file.path,
+                              O_RDONLY | O_CLOEXEC | O_NOCTTY | O_NONBLOCK));
+  if (fd < 0)
+    {
+      return false;
+    }
+
+  std::unique_ptr<hasher> hashers[DIGEST_ALGO_COUNT];
+  for (size_t i = 0; i < DIGEST_ALGO_COUNT; ++i)
+    {
+      if (algos & (1u << i))
+        {
+          hashers[i] = make_hasher (static_cast<digest_algo> (i));
+        }
+    }
+
+  // one read, every selected algorithm fed from the same buffer
+  auto buffer = std::make_unique<uint8_t[]> (READ_CHUNK);
+  while (true)
+    {
+      const ssize_t nread = ::read (fd, buffer.get (), READ_CHUNK);
+      if (nread < 0 && errno == EINTR)
+        {
+          continue;
+        }
+      if (nread < 0)
+        {
+          return false;
+        }
+      if (nread == 0)
+        {
+          break;
+        }
+      for (auto &h : hashers)
+        {
+          if (h)
+            {
+              h->update (buffer.get (), static_cast<size_t> (nread));
+            }
+        }
+    }
+
+  for (size_t i = 0; i < DIGEST_ALGO_COUNT; ++i)
+    {
+      if (hashers[i])
+        {
+          hashers[i]->final (digests.set (static_cast<digest_algo> (i)));
+        }
+    }
+  return true;
+}
+
+void
+files_digests (const std::vector<file_ref> &files, digest_mask algos,
+               std::vector<digest_set> &digests)
+{
+  digests.assign (files.size (), digest_set{});
+
+  if (algos == digest_bit (digest_algo::MD5))
+    {
+      std::vector<std::optional<md5_digest>> md5_digests;
+      md5_files (files, md5_digests);
+      for (size_t i = 0; i < files.size (); ++i)
+        {
+          if (md5_digests[i])
+            {
+              std::memcpy (digests[i].set (digest_algo::MD5), md5_digests[i]->data (),
+                           md5_digests[i]->size ());
+            }
+        }
+      return;
+    }
+
+  for (size_t i = 0; i < files.size (); ++i)
+    {
+      file_digests (files[i], algos, digests[i]);
+    }
+}
+
+} // namespace utils
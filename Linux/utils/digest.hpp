@@ -0,0 +1,122 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "md5.hpp"
+
+namespace utils
+{
+
+enum class digest_algo : unsigned int
+{
+  MD5,
+  SHA256,
+  BLAKE3,
+  XXH3
+};
+
+constexpr size_t DIGEST_ALGO_COUNT = 4;
+
+// set of algorithms, bit i selects digest_algo i
+using digest_mask = unsigned int;
+
+constexpr digest_mask
+digest_bit (digest_algo algo)
+{
+  return 1u << static_cast<unsigned int> (algo);
+}
+
+constexpr digest_mask ALL_DIGESTS = (1u << DIGEST_ALGO_COUNT) - 1;
+
+const char *digest_name (digest_algo algo);
+
+// bytes of a binary digest, half its hex length
+constexpr size_t
+digest_size (digest_algo algo)
+{
+  switch (algo)
+    {
+    case digest_algo::MD5:
+      return 16;
+    case digest_algo::SHA256:
+    case digest_algo::BLAKE3:
+      return 32;
+    case digest_algo::XXH3:
+      return 8;
+    }
+  return 0;
+}
+
+// where `algo` starts in a digest_set, every algorithm before it has a slot
+constexpr size_t
+digest_offset (digest_algo algo)
+{
+  size_t offset = 0;
+  for (unsigned int i = 0; i < static_cast<unsigned int> (algo); ++i)
+    {
+      offset += digest_size (static_cast<digest_algo> (i));
+    }
+  return offset;
+}
+
+constexpr size_t DIGEST_SET_SIZE = digest_offset (digest_algo::XXH3)
+                                   + digest_size (digest_algo::XXH3);
+
+// binary digests of one file, a slot per digest_algo
+class digest_set
+{
+public:
+  digest_mask present () const { return present_; }
+  bool has (digest_algo algo) const { return (present_ & digest_bit (algo)) != 0; }
+  // digest_size (algo) bytes, nullptr unless has (algo)
+  const uint8_t *
+  get (digest_algo algo) const
+  {
+    return has (algo) ? &bytes_[digest_offset (algo)] : nullptr;
+  }
+  // digest_size (algo) bytes to fill, marked present
+  uint8_t *
+  set (digest_algo algo)
+  {
+    present_ |= digest_bit (algo);
+    return &bytes_[digest_offset (algo)];
+  }
+  void clear () { present_ = 0; }
+
+private:
+  digest_mask present_{};
+  std::array<uint8_t, DIGEST_SET_SIZE> bytes_{};
+};
+
+class hasher
+{
+public:
+  virtual ~hasher () = default;
+
+  virtual void update (const void *data, size_t size) = 0;
+  // digest_size bytes of the algorithm to `out`, the hasher starts over afterwards
+  virtual void final (uint8_t *out) = 0;
+};
+
+std::unique_ptr<hasher> make_hasher (digest_algo algo);
+
+/*
+ * Hash a file with every algorithm of `algos` from a single read of its
+ * contents, so adding an algorithm costs cpu but no extra pass over the
+ * disk. Returns false, with `digests` cleared, if the file can't be read.
+ */
+bool file_digests (const file_ref &file, digest_mask algos, digest_set &digests);
+
+/*
+ * Batch form: md5-only batches go through the multi-buffer md5 kernels,
+ * anything else through file_digests one file at a time.
+ */
+void files_digests (const std::vector<file_ref> &files, digest_mask algos,
+                    std::vector<digest_set> &digests);
+
+} // namespace utils
@@ -0,0 +1,140 @@
+#pragma once
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include <cerrno>
+#include <cstring>
+#include <memory>
+#include <string>
+
+#include "scoped_fd.hpp"
+
+namespace utils
+{
+
+struct dir_entry
+{
+  const char *name;
+  ino64_t ino;
+  unsigned char type;
+};
+
+/*
+ * Directory stream on top of getdents64(2).
+ *
+ * The directory fd stays open for the lifetime of the reader so that
+ * children can be opened/stat-ed relative to it (openat/fstatat) instead
+ * of making the kernel walk the full path again for every entry.
+ * Entries are read in large batches; `name` of a returned entry points
+ * into the internal buffer and is only valid until the next call.
+ */
+class dir_reader
+{
+public:
+  static constexpr size_t BUFFER_SIZE = 32 * 1024;
+
+  explicit dir_reader (const std::string &path)
+      : fd_{ ::open (path.c_str (), O_RDONLY | O_DIRECTORY | O_CLOEXEC) }
+  {
+  }
+
+  // open `name` relative to an already opened directory
+  dir_reader (int parent_fd, const char *name)
+      : fd_{ ::openat (parent_fd, name,
+                       O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC) }
+  {
+  }
+
+  dir_reader (const dir_reader &) = delete;
+  dir_reader &operator= (const dir_reader &) = delete;
+
+  bool
+  is_open () const noexcept
+  {
+    return fd_ > -1;
+  }
+
+  int
+  fd () const noexcept
+  {
+    return fd_;
+  }
+
+  // errno of the last failed getdents64, 0 on a clean end of stream
+  int
+  error () const noexcept
+  {
+    return error_;
+  }
+
+  // "." and ".." are skipped
+  bool
+  next (dir_entry &entry)
+  {
+    while (true)
+      {
+        if (pos_ >= end_ && !fill_ ())
+          {
+            return false;
+          }
+
+        const auto *dirp
+            = reinterpret_cast<const struct dirent64 *> (buffer_.get () + pos_);
+        pos_ += dirp->d_reclen;
+
+        const char *name = dirp->d_name;
+        if (name[0] == '.'
+            && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0')))
+          {
+            continue;
+          }
+
+        entry.name = name;
+        entry.ino = dirp->d_ino;
+        entry.type = dirp->d_type;
+        return true;
+      }
+  }
+
+private:
+  bool
+  fill_ ()
+  {
+    if (!is_open ())
+      {
+        return false;
+      }
+
+    if (!buffer_)
+      {
+        buffer_ = std::make_unique<char[]> (BUFFER_SIZE);
+      }
+
+    const long nread = ::syscall (SYS_getdents64, static_cast<int> (fd_),
+                                  buffer_.get (), BUFFER_SIZE);
+    if (nread <= 0)
+      {
+        error_ = nread < 0 ? errno : 0;
+        // the fd may outlive the listing (children openat), the buffer not
+        buffer_.reset ();
+        pos_ = end_ = 0;
+        return false;
+      }
+
+    pos_ = 0;
+    end_ = static_cast<size_t> (nread);
+    return true;
+  }
+
+private:
+  usb::ScopedFd fd_;
+  std::unique_ptr<char[]> buffer_;
+  size_t pos_{};
+  size_t end_{};
+  int error_{};
+};
+
+} // namespace utils
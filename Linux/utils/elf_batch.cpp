@@ -0,0 +1,316 @@
+#include "elf_batch.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#include "elf_check.hpp"
+#include "io_uring.hpp"
+
+namespace utils
+{
+
+namespace
+{
+
+// each file takes two sqes in the read phase
+constexpr unsigned int RING_ENTRIES = 256;
+constexpr size_t BATCH_SIZE = RING_ENTRIES / 2;
+
+// low bit of a read-phase user_data
+constexpr uint64_t CLOSE_TAG = 1;
+
+// the scanner leaves half of RLIMIT_NOFILE to file checks: the batches
+// of every thread hold half of that at most, hashing needs the rest
+long
+initial_fd_budget ()
+{
+  struct rlimit nofile{};
+  if (::getrlimit (RLIMIT_NOFILE, &nofile) != 0 || nofile.rlim_cur == RLIM_INFINITY)
+    {
+      return 4096;
+    }
+  return static_cast<long> (nofile.rlim_cur / 4);
+}
+
+std::atomic<long> &
+fd_budget ()
+{
+  static std::atomic<long> budget{ initial_fd_budget () };
+  return budget;
+}
+
+// up to `wanted` fds of the budget, none when it is spent
+size_t
+take_fds (size_t wanted)
+{
+  auto &budget = fd_budget ();
+  long available = budget.load ();
+  long granted;
+  do
+    {
+      if (available <= 0)
+        {
+          return 0;
+        }
+      granted = std::min (static_cast<long> (wanted), available);
+    }
+  while (!budget.compare_exchange_weak (available, available - granted));
+  return static_cast<size_t> (granted);
+}
+
+void
+give_fds (size_t count)
+{
+  fd_budget ().fetch_add (static_cast<long> (count));
+}
+
+void
+check_one (elf_probe &probe)
+{
+  int elf_type{};
+  if (check_if_valid_elf (probe.dirfd, probe.name, elf_type))
+    {
+      probe.elf_type = elf_type;
+    }
+  else
+    {
+      probe.elf_type = elf_type == ELF_UNREADABLE ? ELF_PROBE_UNREADABLE : ELF_PROBE_INVALID;
+    }
+}
+
+// one ring per thread, set up on first use; null if io_uring can't be used
+io_ring *
+thread_ring ()
+{
+  thread_local io_ring ring;
+  thread_local bool tried = false;
+  if (!tried)
+    {
+      tried = true;
+      ring.init (RING_ENTRIES, { IORING_OP_OPENAT, IORING_OP_READ, IORING_OP_CLOSE });
+    }
+  return ring.ready () ? &ring : nullptr;
+}
+
+// submit what is queued and reap until `expected` completions came in;
+// on failure, still waits for those of the sqes the kernel took
+bool
+complete (io_ring &ring, unsigned int expected, void (*on_cqe) (const io_uring_cqe &, void *),
+          void *context)
+{
+  const auto reap = [&] {
+    return ring.reap ([&] (const io_uring_cqe &cqe) { on_cqe (cqe, context); });
+  };
+
+  unsigned int done = 0;
+  while (done < expected)
+    {
+      const int ret = ring.submit (expected - done);
+      if (ret < 0 && ret != -EAGAIN && ret != -EBUSY)
+        {
+          // one completion per sqe taken, none for those left queued
+          const unsigned int taken = expected - ring.unsubmitted ();
+          done += reap ();
+          while (done < taken && ring.wait (taken - done) >= 0)
+            {
+              done += reap ();
+            }
+          return false;
+        }
+      done += reap ();
+    }
+  return true;
+}
+
+struct batch_state
+{
+  int fds[BATCH_SIZE];
+  // the open's fd or -errno, kept once the fd is closed
+  int open_results[BATCH_SIZE];
+  T::Ehdr headers[BATCH_SIZE];
+  int read_results[BATCH_SIZE];
+  // read and close pairs queued, in queue order
+  size_t pairs[BATCH_SIZE];
+};
+
+// a failed phase: close what the ring was to close and never will
+void
+close_left (const io_ring &ring, batch_state &batch, size_t count, unsigned int queued_pairs)
+{
+  if (queued_pairs == 0)
+    {
+      // the open phase, each fd seen is ours
+      for (size_t i = 0; i < count; ++i)
+        {
+          if (batch.fds[i] >= 0)
+            {
+              ::close (batch.fds[i]);
+              batch.fds[i] = -1;
+            }
+        }
+      return;
+    }
+
+  // sqes are taken in order: a pair whose close went is the kernel's
+  const unsigned int taken = queued_pairs * 2 - ring.unsubmitted ();
+  for (size_t pair = taken / 2; pair < queued_pairs; ++pair)
+    {
+      const size_t i = batch.pairs[pair];
+      if (batch.fds[i] >= 0)
+        {
+          ::close (batch.fds[i]);
+          batch.fds[i] = -1;
+        }
+    }
+}
+
+void
+on_open (const io_uring_cqe &cqe, void *context)
+{
+  auto &batch = *static_cast<batch_state *> (context);
+  batch.fds[cqe.user_data] = cqe.res;
+  batch.open_results[cqe.user_data] = cqe.res;
+}
+
+void
+on_read_or_close (const io_uring_cqe &cqe, void *context)
+{
+  auto &batch = *static_cast<batch_state *> (context);
+  const size_t index = cqe.user_data >> 1;
+  if (cqe.user_data & CLOSE_TAG)
+    {
+      if (cqe.res < 0)
+        {
+          ::close (batch.fds[index]);
+        }
+      batch.fds[index] = -1;
+    }
+  else
+    {
+      batch.read_results[index] = cqe.res;
+    }
+}
+
+// false if the ring broke down, its fds closed; the caller finishes the
+// batch blocking
+bool
+check_batch (io_ring &ring, elf_probe *probes, size_t count, batch_state &batch)
+{
+  for (size_t i = 0; i < count; ++i)
+    {
+      io_uring_sqe *sqe = ring.get_sqe ();
+      sqe->opcode = IORING_OP_OPENAT;
+      sqe->fd = probes[i].dirfd;
+      sqe->addr = reinterpret_cast<uintptr_t> (probes[i].name);
+      sqe->open_flags = O_RDONLY | O_CLOEXEC | O_NOCTTY | O_NONBLOCK;
+      sqe->user_data = i;
+      batch.fds[i] = -1;
+      batch.open_results[i] = -EIO;
+      batch.read_results[i] = 0;
+    }
+  if (!complete (ring, static_cast<unsigned int> (count), on_open, &batch))
+    {
+      close_left (ring, batch, count, 0);
+      return false;
+    }
+
+  // a hard link closes the file even when the read falls short
+  unsigned int opened = 0;
+  for (size_t i = 0; i < count; ++i)
+    {
+      if (batch.fds[i] < 0)
+        {
+          continue;
+        }
+      io_uring_sqe *read = ring.get_sqe ();
+      read->opcode = IORING_OP_READ;
+      read->flags = IOSQE_IO_HARDLINK;
+      read->fd = batch.fds[i];
+      read->addr = reinterpret_cast<uintptr_t> (&batch.headers[i]);
+      read->len = sizeof (T::Ehdr);
+      read->off = 0;
+      read->user_data = i << 1;
+
+      io_uring_sqe *close = ring.get_sqe ();
+      close->opcode = IORING_OP_CLOSE;
+      close->fd = batch.fds[i];
+      close->user_data = (i << 1) | CLOSE_TAG;
+      batch.pairs[opened++] = i;
+    }
+  if (opened != 0 && !complete (ring, opened * 2, on_read_or_close, &batch))
+    {
+      close_left (ring, batch, count, opened);
+      return false;
+    }
+
+  for (size_t i = 0; i < count; ++i)
+    {
+      const auto &header = batch.headers[i];
+      if (batch.open_results[i] == -EMFILE || batch.open_results[i] == -ENFILE)
+        {
+          // out of fds then, the batch's own are closed by now
+          check_one (probes[i]);
+        }
+      else if (batch.open_results[i] < 0 || batch.read_results[i] < 0)
+        {
+          probes[i].elf_type = ELF_PROBE_UNREADABLE;
+        }
+      else if (batch.read_results[i] == static_cast<int> (sizeof (T::Ehdr))
+               && detail::ElfHeaderCheck<>::checkHeader (header))
+        {
+          probes[i].elf_type = detail::ElfHeaderCheck<>::getType (header);
+        }
+      else
+        {
+          probes[i].elf_type = ELF_PROBE_INVALID;
+        }
+    }
+  return true;
+}
+
+} // namespace
+
+void
+check_if_valid_elfs (std::vector<elf_probe> &probes)
+{
+  io_ring *ring = probes.size () > 1 ? thread_ring () : nullptr;
+  size_t begin = 0;
+  if (ring != nullptr)
+    {
+      thread_local batch_state batch;
+      while (begin < probes.size ())
+        {
+          // a batch holds an fd per file until its closes complete
+          const size_t count = take_fds (std::min (BATCH_SIZE, probes.size () - begin));
+          if (count < 2)
+            {
+              // other threads' batches hold the budget: a file at a time meanwhile
+              give_fds (count);
+              check_one (probes[begin++]);
+              continue;
+            }
+          const bool checked = check_batch (*ring, probes.data () + begin, count, batch);
+          give_fds (count);
+          if (!checked)
+            {
+              // completions may be left behind: this thread goes blocking
+              ring->close ();
+              break;
+            }
+          begin += count;
+        }
+    }
+
+  for (; begin < probes.size (); ++begin)
+    {
+      check_one (probes[begin]);
+    }
+}
+
+} // namespace utils
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <vector>
+
+namespace utils
+{
+
+// one file for check_if_valid_elfs, `name` relative to `dirfd`
+struct elf_probe
+{
+  int dirfd;
+  const char *name;
+  // out: e_type of a valid ELF header, ELF_PROBE_INVALID for a header
+  // read and turned down, ELF_PROBE_UNREADABLE if it couldn't be read
+  int elf_type;
+};
+
+constexpr int ELF_PROBE_INVALID = -1;
+constexpr int ELF_PROBE_UNREADABLE = -2;
+
+/*
+ * check_if_valid_elf for many files at once. With io_uring the opens of
+ * a whole batch go out in one submission, then the header reads with
+ * their closes in a second one, and every file is classified from its
+ * completions: two syscalls per batch instead of three per file. The
+ * batches of all threads share a budget of open fds, a quarter of
+ * RLIMIT_NOFILE, and an open refused for lack of fds is tried again
+ * blocking once the batch is closed. Falls back to the blocking check,
+ * file by file, where io_uring is missing, disabled or lacks
+ * openat/read/close (before linux 5.6).
+ */
+void check_if_valid_elfs (std::vector<elf_probe> &probes);
+
+} // namespace utils
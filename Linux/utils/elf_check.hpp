@@ -10,6 +10,11 @@
 #include <cstring>
 #include <cctype>
 
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "scoped_fd.hpp"
+
 #if defined(__LP64__)
     typedef uint64_t bl_uintptr;
 #else
@@ -127,6 +132,13 @@ struct ElfHeaderCheck : public ElfHeaderCommonCheck
 
 using T = detail::ElfHeaderCheck<>::TypeTraits;
 
+// a file shorter than this can't pass check_if_valid_elf
+constexpr size_t ELF_MIN_FILE_SIZE = sizeof(T::Ehdr);
+
+// elf_type check_if_valid_elf leaves when the file can't be opened or
+// read: nothing is known about it, unlike a header read and turned down
+constexpr int ELF_UNREADABLE = -2;
+
 
 static inline
 bool 
@@ -136,9 +148,17 @@ check_if_valid_elf(std::string const& path, int& elf_type)
     std::unique_ptr<std::FILE, decltype(&::fclose)> file(::fopen(path.c_str(), "rb"), &::fclose);
 
     if(!file)
+    {
+        elf_type = ELF_UNREADABLE;
         return false;
+    }
 
-    ::fread(&header, sizeof(header), 1, file.get());
+    if(::fread(&header, sizeof(header), 1, file.get()) != 1)
+    {
+        // too short for a header, or a read error
+        elf_type = ::ferror(file.get()) ? ELF_UNREADABLE : ET_NONE;
+        return false;
+    }
 
     // LOG_INFO("path:{}, e_type:{:x}, e_version:{:x}, elf_version:{:x}", 
     //                 path, 
@@ -150,6 +170,31 @@ check_if_valid_elf(std::string const& path, int& elf_type)
     return detail::ElfHeaderCheck<>::checkHeader(header);
 }
 
+// same check, with `name` resolved relative to the directory fd `dirfd`
+static inline
+bool
+check_if_valid_elf(int dirfd, const char* name, int& elf_type)
+{
+    T::Ehdr header;
+    usb::ScopedFd fd(::openat(dirfd, name, O_RDONLY | O_CLOEXEC | O_NOCTTY | O_NONBLOCK));
+
+    if(fd < 0)
+    {
+        elf_type = ELF_UNREADABLE;
+        return false;
+    }
+
+    const ssize_t nread = ::pread(fd, &header, sizeof(header), 0);
+    if(nread != static_cast<ssize_t>(sizeof(header)))
+    {
+        elf_type = nread < 0 ? ELF_UNREADABLE : ET_NONE;
+        return false;
+    }
+
+    elf_type = detail::ElfHeaderCheck<>::getType(header);
+    return detail::ElfHeaderCheck<>::checkHeader(header);
+}
+
 }  // namespace utils
 
 
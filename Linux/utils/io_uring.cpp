@@ -0,0 +1,215 @@
+#include "io_uring.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <vector>
+
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+namespace utils
+{
+
+namespace
+{
+
+int
+sys_io_uring_setup (unsigned int entries, io_uring_params *params)
+{
+  return static_cast<int> (::syscall (__NR_io_uring_setup, entries, params));
+}
+
+int
+sys_io_uring_enter (int fd, unsigned int to_submit, unsigned int min_complete,
+                    unsigned int flags)
+{
+  return static_cast<int> (
+      ::syscall (__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0));
+}
+
+int
+sys_io_uring_register (int fd, unsigned int opcode, void *arg, unsigned int nr_args)
+{
+  return static_cast<int> (::syscall (__NR_io_uring_register, fd, opcode, arg, nr_args));
+}
+
+template <typename T>
+T *
+ring_field (void *ring, uint32_t offset)
+{
+  return reinterpret_cast<T *> (static_cast<char *> (ring) + offset);
+}
+
+} // namespace
+
+io_ring::~io_ring ()
+{
+  close ();
+}
+
+void
+io_ring::close ()
+{
+  unmap_ ();
+  if (ring_fd_ >= 0)
+    {
+      ::close (ring_fd_);
+      ring_fd_ = -1;
+    }
+  sq_entries_ = 0;
+  sq_pending_ = 0;
+}
+
+bool
+io_ring::init (unsigned int entries, std::initializer_list<uint8_t> ops)
+{
+  io_uring_params params;
+  std::memset (&params, 0, sizeof (params));
+  const int fd = sys_io_uring_setup (entries, &params);
+  if (fd < 0)
+    {
+      return false;
+    }
+  ring_fd_ = fd;
+
+  // one mapping for both rings, linux 5.4; every op we use is newer
+  if ((params.features & IORING_FEAT_SINGLE_MMAP) == 0 || !supports_ (ops))
+    {
+      ::close (ring_fd_);
+      ring_fd_ = -1;
+      return false;
+    }
+
+  ring_size_ = std::max (params.sq_off.array + params.sq_entries * sizeof (unsigned int),
+                         params.cq_off.cqes + params.cq_entries * sizeof (io_uring_cqe));
+  ring_ptr_ = ::mmap (nullptr, ring_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      ring_fd_, IORING_OFF_SQ_RING);
+  sqes_size_ = params.sq_entries * sizeof (io_uring_sqe);
+  void *sqes = ::mmap (nullptr, sqes_size_, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                       ring_fd_, IORING_OFF_SQES);
+  if (ring_ptr_ == MAP_FAILED || sqes == MAP_FAILED)
+    {
+      if (ring_ptr_ == MAP_FAILED)
+        {
+          ring_ptr_ = nullptr;
+        }
+      sqes_ = sqes == MAP_FAILED ? nullptr : static_cast<io_uring_sqe *> (sqes);
+      unmap_ ();
+      ::close (ring_fd_);
+      ring_fd_ = -1;
+      return false;
+    }
+  sqes_ = static_cast<io_uring_sqe *> (sqes);
+
+  sq_entries_ = params.sq_entries;
+  sq_head_ = ring_field<unsigned int> (ring_ptr_, params.sq_off.head);
+  sq_tail_ = ring_field<unsigned int> (ring_ptr_, params.sq_off.tail);
+  sq_mask_ = ring_field<unsigned int> (ring_ptr_, params.sq_off.ring_mask);
+  sq_array_ = ring_field<unsigned int> (ring_ptr_, params.sq_off.array);
+  cq_head_ = ring_field<unsigned int> (ring_ptr_, params.cq_off.head);
+  cq_tail_ = ring_field<unsigned int> (ring_ptr_, params.cq_off.tail);
+  cq_mask_ = ring_field<unsigned int> (ring_ptr_, params.cq_off.ring_mask);
+  cqes_ = ring_field<io_uring_cqe> (ring_ptr_, params.cq_off.cqes);
+  return true;
+}
+
+bool
+io_ring::supports_ (std::initializer_list<uint8_t> ops) const
+{
+  // the probe ends with one io_uring_probe_op per opcode
+  std::vector<uint64_t> storage ((sizeof (io_uring_probe) + 256 * sizeof (io_uring_probe_op))
+                                     / sizeof (uint64_t)
+                                 + 1);
+  auto *probe = reinterpret_cast<io_uring_probe *> (storage.data ());
+  if (sys_io_uring_register (ring_fd_, IORING_REGISTER_PROBE, probe, 256) < 0)
+    {
+      return false;
+    }
+  for (const auto op : ops)
+    {
+      if (op > probe->last_op || (probe->ops[op].flags & IO_URING_OP_SUPPORTED) == 0)
+        {
+          return false;
+        }
+    }
+  return true;
+}
+
+void
+io_ring::unmap_ ()
+{
+  if (sqes_ != nullptr)
+    {
+      ::munmap (sqes_, sqes_size_);
+      sqes_ = nullptr;
+    }
+  if (ring_ptr_ != nullptr)
+    {
+      ::munmap (ring_ptr_, ring_size_);
+      ring_ptr_ = nullptr;
+    }
+}
+
+io_uring_sqe *
+io_ring::get_sqe ()
+{
+  // only this thread moves the tail, the kernel moves the head
+  const unsigned int tail = *sq_tail_ + sq_pending_;
+  if (tail - __atomic_load_n (sq_head_, __ATOMIC_ACQUIRE) >= sq_entries_)
+    {
+      return nullptr;
+    }
+
+  const unsigned int index = tail & *sq_mask_;
+  io_uring_sqe *sqe = &sqes_[index];
+  std::memset (sqe, 0, sizeof (*sqe));
+  sq_array_[index] = index;
+  ++sq_pending_;
+  return sqe;
+}
+
+unsigned int
+io_ring::unsubmitted () const
+{
+  // without sqpoll the head only moves in io_uring_enter
+  return *sq_tail_ - __atomic_load_n (sq_head_, __ATOMIC_ACQUIRE) + sq_pending_;
+}
+
+int
+io_ring::submit (unsigned int wait_nr)
+{
+  if (sq_pending_ != 0)
+    {
+      __atomic_store_n (sq_tail_, *sq_tail_ + sq_pending_, __ATOMIC_RELEASE);
+      sq_pending_ = 0;
+    }
+
+  for (;;)
+    {
+      // everything published the kernel hasn't taken, earlier calls' leftovers included
+      const unsigned int to_submit = unsubmitted ();
+      const int ret = sys_io_uring_enter (ring_fd_, to_submit, wait_nr,
+                                          wait_nr != 0 ? IORING_ENTER_GETEVENTS : 0);
+      if (ret >= 0 || errno != EINTR)
+        {
+          return ret < 0 ? -errno : ret;
+        }
+    }
+}
+
+int
+io_ring::wait (unsigned int wait_nr)
+{
+  for (;;)
+    {
+      const int ret = sys_io_uring_enter (ring_fd_, 0, wait_nr, IORING_ENTER_GETEVENTS);
+      if (ret >= 0 || errno != EINTR)
+        {
+          return ret < 0 ? -errno : ret;
+        }
+    }
+}
+
+} // namespace utils
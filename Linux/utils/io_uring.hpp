@@ -0,0 +1,86 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+
+#include <linux/io_uring.h>
+
+namespace utils
+{
+
+/*
+ * Minimal io_uring over the raw syscalls (no liburing): one submission
+ * and one completion ring, driven by a single thread. Meant to be kept
+ * per thread, the rings aren't shared.
+ */
+class io_ring
+{
+public:
+  io_ring () = default;
+  ~io_ring ();
+
+  io_ring (io_ring const &) = delete;
+  io_ring &operator= (io_ring const &) = delete;
+
+  // false if the kernel has no io_uring, it is disabled, or one of `ops`
+  // (IORING_OP_*) isn't supported
+  bool init (unsigned int entries, std::initializer_list<uint8_t> ops);
+  bool ready () const { return ring_fd_ >= 0; }
+  unsigned int entries () const { return sq_entries_; }
+
+  // a zeroed sqe, nullptr when the submission ring is full
+  io_uring_sqe *get_sqe ();
+  // hand queued sqes to the kernel and wait for `wait_nr` completions;
+  // those a partial submit or -EAGAIN left go again with the next call
+  int submit (unsigned int wait_nr);
+  // wait for `wait_nr` completions, submitting nothing
+  int wait (unsigned int wait_nr);
+  // sqes queued and not taken by the kernel yet, in queue order the last
+  unsigned int unsubmitted () const;
+  // back to not ready (); queued sqes never run, unreaped completions go
+  void close ();
+
+  // fn (const io_uring_cqe &) for each completion ready, returns how many
+  template <typename F>
+  unsigned int
+  reap (F &&fn)
+  {
+    unsigned int head = *cq_head_;
+    const unsigned int tail = __atomic_load_n (cq_tail_, __ATOMIC_ACQUIRE);
+    unsigned int count = 0;
+    for (; head != tail; ++head, ++count)
+      {
+        fn (cqes_[head & *cq_mask_]);
+      }
+    __atomic_store_n (cq_head_, head, __ATOMIC_RELEASE);
+    return count;
+  }
+
+private:
+  bool supports_ (std::initializer_list<uint8_t> ops) const;
+  void unmap_ ();
+
+private:
+  int ring_fd_{ -1 };
+  unsigned int sq_entries_{};
+
+  void *ring_ptr_{};
+  size_t ring_size_{};
+  io_uring_sqe *sqes_{};
+  size_t sqes_size_{};
+
+  unsigned int *sq_head_{};
+  unsigned int *sq_tail_{};
+  unsigned int *sq_mask_{};
+  unsigned int *sq_array_{};
+  // sqes filled since the last submit, not yet visible to the kernel
+  unsigned int sq_pending_{};
+
+  unsigned int *cq_head_{};
+  unsigned int *cq_tail_{};
+  unsigned int *cq_mask_{};
+  io_uring_cqe *cqes_{};
+};
+
+} // namespace utils
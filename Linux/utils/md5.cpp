@@ -0,0 +1,448 @@
+#include "md5.hpp"
+#include "md5_mb.hpp"
+#include "md5_rounds.hpp"
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <memory>
+
+#include "scoped_fd.hpp"
+
+namespace utils
+{
+namespace
+{
+
+constexpr uint32_t MD5_IV[4] = { 0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476 };
+constexpr size_t READ_CHUNK = 64 * 1024;
+constexpr unsigned int MAX_LANES = 16;
+
+inline uint32_t rotl32 (uint32_t x, int s) { return (x << s) | (x >> (32 - s)); }
+
+inline uint32_t md5_F (uint32_t b, uint32_t c, uint32_t d) { return d ^ (b & (c ^ d)); }
+inline uint32_t md5_G (uint32_t b, uint32_t c, uint32_t d) { return c ^ (d & (b ^ c)); }
+inline uint32_t md5_H (uint32_t b, uint32_t c, uint32_t d) { return b ^ c ^ d; }
+inline uint32_t md5_I (uint32_t b, uint32_t c, uint32_t d) { return c ^ (b | ~d); }
+
+inline uint32_t
+load_le32 (const uint8_t *p)
+{
+  return static_cast<uint32_t> (p[0]) | static_cast<uint32_t> (p[1]) << 8
+         | static_cast<uint32_t> (p[2]) << 16 | static_cast<uint32_t> (p[3]) << 24;
+}
+
+inline void
+store_le32 (uint8_t *p, uint32_t v)
+{
+  p[0] = static_cast<uint8_t> (v);
+  p[1] = static_cast<uint8_t> (v >> 8);
+  p[2] = static_cast<uint8_t> (v >> 16);
+  p[3] = static_cast<uint8_t> (v >> 24);
+}
+
+inline void
+store_le64 (uint8_t *p, uint64_t v)
+{
+  store_le32 (p, static_cast<uint32_t> (v));
+  store_le32 (p + 4, static_cast<uint32_t> (v >> 32));
+}
+
+void
+md5_transform (uint32_t state[4], const uint8_t block[64])
+{
+  uint32_t words[16];
+  for (int i = 0; i < 16; ++i)
+    {
+      words[i] = load_le32 (block + 4 * i);
+    }
+
+  uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+
+#define MD5_STEP(fn, a, b, c, d, x, s, t)                                     \
+  a = b + rotl32 (a + md5_##fn (b, c, d) + words[x] + (t), s);
+
+  MD5_ROUNDS (MD5_STEP)
+
+#undef MD5_STEP
+
+  state[0] += a;
+  state[1] += b;
+  state[2] += c;
+  state[3] += d;
+}
+
+int
+open_file (const file_ref &file)
+{
+  return ::openat (file.dirfd, file.path,
+                   O_RDONLY | O_CLOEXEC | O_NOCTTY | O_NONBLOCK);
+}
+
+// like read(2), but retried on EINTR
+ssize_t
+read_some (int fd, void *buffer, size_t size)
+{
+  ssize_t nread;
+  do
+    {
+      nread = ::read (fd, buffer, size);
+    }
+  while (nread < 0 && errno == EINTR);
+  return nread;
+}
+
+/*
+ * One file streamed through a SIMD lane, block by block, MD5 padding
+ * included.
+ */
+class mb_lane
+{
+public:
+  mb_lane () = default;
+  mb_lane (const mb_lane &) = delete;
+  mb_lane &operator= (const mb_lane &) = delete;
+  ~mb_lane () { close (); }
+
+  bool
+  open (const file_ref &file)
+  {
+    close ();
+    fd_ = open_file (file);
+    if (fd_ < 0)
+      {
+        return false;
+      }
+    if (!buffer_)
+      {
+        buffer_ = std::make_unique<uint8_t[]> (READ_CHUNK);
+      }
+    pos_ = len_ = 0;
+    total_ = 0;
+    eof_ = false;
+    tail_blocks_ = tail_next_ = 0;
+    return true;
+  }
+
+  void
+  close ()
+  {
+    if (fd_ >= 0)
+      {
+        ::close (fd_);
+        fd_ = -1;
+      }
+  }
+
+  bool
+  active () const
+  {
+    return fd_ >= 0;
+  }
+
+  // 1: next block copied out, 0: message done, -1: read error
+  int
+  next_block (uint8_t block[64])
+  {
+    if (tail_blocks_ == 0)
+      {
+        if (len_ - pos_ < 64 && !eof_)
+          {
+            std::memmove (buffer_.get (), buffer_.get () + pos_, len_ - pos_);
+            len_ -= pos_;
+            pos_ = 0;
+            while (len_ < 64 && !eof_)
+              {
+                const ssize_t nread
+                    = read_some (fd_, buffer_.get () + len_, READ_CHUNK - len_);
+                if (nread < 0)
+                  {
+                    return -1;
+                  }
+                eof_ = nread == 0;
+                len_ += static_cast<size_t> (nread);
+              }
+          }
+
+        if (len_ - pos_ >= 64)
+          {
+            std::memcpy (block, buffer_.get () + pos_, 64);
+            pos_ += 64;
+            total_ += 64;
+            return 1;
+          }
+
+        // end of file: remaining bytes + 0x80 + zeros + bit length
+        const size_t rest = len_ - pos_;
+        total_ += rest;
+        tail_blocks_ = rest < 56 ? 1 : 2;
+        std::memset (tail_, 0, sizeof (tail_));
+        std::memcpy (tail_, buffer_.get () + pos_, rest);
+        tail_[rest] = 0x80;
+        store_le64 (tail_ + tail_blocks_ * 64 - 8, total_ * 8);
+        pos_ = len_;
+      }
+
+    if (tail_next_ < tail_blocks_)
+      {
+        std::memcpy (block, tail_ + 64 * tail_next_, 64);
+        ++tail_next_;
+        return 1;
+      }
+    return 0;
+  }
+
+private:
+  int fd_ = -1;
+  std::unique_ptr<uint8_t[]> buffer_;
+  size_t pos_{};
+  size_t len_{};
+  uint64_t total_{};
+  bool eof_{};
+  uint8_t tail_[128];
+  int tail_blocks_{};
+  int tail_next_{};
+};
+
+struct mb_impl
+{
+  unsigned int lanes;
+  detail::md5_mb_kernel kernel;
+};
+
+mb_impl
+select_mb (unsigned int max_lanes)
+{
+#if defined(HK_MD5_MB_X86)
+  static const bool has_avx512 = (__builtin_cpu_init (), __builtin_cpu_supports ("avx512f"));
+  static const bool has_avx2 = __builtin_cpu_supports ("avx2");
+  static const bool has_sse2 = __builtin_cpu_supports ("sse2");
+
+  const auto allows = [max_lanes] (unsigned int lanes) {
+    return max_lanes == 0 || max_lanes >= lanes;
+  };
+  if (has_avx512 && allows (16))
+    return { 16, &detail::md5_mb_x16_avx512 };
+  if (has_avx2 && allows (8))
+    return { 8, &detail::md5_mb_x8_avx2 };
+  if (has_sse2 && allows (4))
+    return { 4, &detail::md5_mb_x4_sse2 };
+#else
+  (void)max_lanes;
+#endif
+  return { 1, nullptr };
+}
+
+void
+md5_files_mb (const mb_impl &impl, const std::vector<file_ref> &files,
+              std::vector<std::optional<md5_digest>> &digests)
+{
+  const unsigned int lanes = impl.lanes;
+  alignas (64) uint32_t state[4 * MAX_LANES] = {};
+  alignas (64) uint32_t words[16 * MAX_LANES] = {};
+  mb_lane lane[MAX_LANES];
+  size_t lane_file[MAX_LANES] = {};
+  size_t next_file = 0;
+  uint8_t block[64];
+
+  // keep `l` fed: finish its current file when drained, move on to the next
+  const auto load_lane = [&] (unsigned int l) {
+    while (true)
+      {
+        if (lane[l].active ())
+          {
+            const int status = lane[l].next_block (block);
+            if (status > 0)
+              {
+                for (int w = 0; w < 16; ++w)
+                  {
+                    words[w * lanes + l] = load_le32 (block + 4 * w);
+                  }
+                return true;
+              }
+            if (status == 0)
+              {
+                md5_digest &digest = digests[lane_file[l]].emplace ();
+                for (int i = 0; i < 4; ++i)
+                  {
+                    store_le32 (digest.data () + 4 * i, state[i * lanes + l]);
+                  }
+              }
+            lane[l].close ();
+          }
+
+        if (next_file >= files.size ())
+          {
+            return false;
+          }
+        lane_file[l] = next_file++;
+        if (lane[l].open (files[lane_file[l]]))
+          {
+            for (int i = 0; i < 4; ++i)
+              {
+                state[i * lanes + l] = MD5_IV[i];
+              }
+          }
+      }
+  };
+
+  while (true)
+    {
+      bool any = false;
+      for (unsigned int l = 0; l < lanes; ++l)
+        {
+          any = load_lane (l) || any;
+        }
+      if (!any)
+        {
+          break;
+        }
+      impl.kernel (state, words);
+    }
+}
+
+} // namespace
+
+void
+md5_context::reset ()
+{
+  std::memcpy (state_, MD5_IV, sizeof (state_));
+  length_ = 0;
+}
+
+void
+md5_context::update (const void *data, size_t size)
+{
+  const auto *input = static_cast<const uint8_t *> (data);
+  size_t used = static_cast<size_t> (length_ % 64);
+  length_ += size;
+
+  if (used != 0)
+    {
+      const size_t fill = std::min (size, 64 - used);
+      std::memcpy (buffer_ + used, input, fill);
+      input += fill;
+      size -= fill;
+      if (used + fill < 64)
+        {
+          return;
+        }
+      md5_transform (state_, buffer_);
+    }
+
+  for (; size >= 64; input += 64, size -= 64)
+    {
+      md5_transform (state_, input);
+    }
+
+  std::memcpy (buffer_, input, size);
+}
+
+md5_digest
+md5_context::final ()
+{
+  const uint64_t bit_length = length_ * 8;
+  const size_t used = static_cast<size_t> (length_ % 64);
+
+  uint8_t padding[128] = { 0x80 };
+  const size_t pad_size = (used < 56 ? 56 : 120) - used;
+  update (padding, pad_size);
+
+  uint8_t length_le[8];
+  store_le64 (length_le, bit_length);
+  update (length_le, sizeof (length_le));
+
+  md5_digest digest;
+  for (int i = 0; i < 4; ++i)
+    {
+      store_le32 (digest.data () + 4 * i, state_[i]);
+    }
+  reset ();
+  return digest;
+}
+
+std::string
+to_hex (const uint8_t *data, size_t size)
+{
+  static const char digits[] = "0123456789abcdef";
+  std::string hex (size * 2, '0');
+  for (size_t i = 0; i < size; ++i)
+    {
+      hex[2 * i] = digits[data[i] >> 4];
+      hex[2 * i + 1] = digits[data[i] & 0x0f];
+    }
+  return hex;
+}
+
+std::string
+md5 (const std::string &file_path)
+{
+  md5_digest digest;
+  if (!md5 (file_ref{ AT_FDCWD, file_path.c_str () }, digest))
+    {
+      return {};
+    }
+  return to_hex (digest);
+}
+
+bool
+md5 (const file_ref &file, md5_digest &digest)
+{
+  usb::ScopedFd fd (open_file (file));
+  if (fd < 0)
+    {
+      return false;
+    }
+
+  auto buffer = std::make_unique<uint8_t[]> (READ_CHUNK);
+  md5_context context;
+  while (true)
+    {
+      const ssize_t nread = read_some (fd, buffer.get (), READ_CHUNK);
+      if (nread < 0)
+        {
+          return false;
+        }
+      if (nread == 0)
+        {
+          break;
+        }
+      context.update (buffer.get (), static_cast<size_t> (nread));
+    }
+  digest = context.final ();
+  return true;
+}
+
+void
+md5_files (const std::vector<file_ref> &files,
+           std::vector<std::optional<md5_digest>> &digests, unsigned int max_lanes)
+{
+  digests.assign (files.size (), std::nullopt);
+
+  const mb_impl impl = select_mb (max_lanes);
+  // a lone file gains nothing from idle lanes
+  if (impl.lanes == 1 || files.size () == 1)
+    {
+      for (size_t i = 0; i < files.size (); ++i)
+        {
+          md5_digest digest;
+          if (md5 (files[i], digest))
+            {
+              digests[i] = digest;
+            }
+        }
+      return;
+    }
+
+  md5_files_mb (impl, files, digests);
+}
+
+unsigned int
+md5_mb_lanes ()
+{
+  return select_mb (0).lanes;
+}
+
+} // namespace utils
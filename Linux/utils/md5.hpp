@@ -1,15 +1,70 @@
 #pragma once
 
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
 #include <string>
+#include <vector>
+
+#include <fcntl.h>
+
 namespace utils
 {
 
-inline 
-std::string 
-md5(const std::string& file_path)
+using md5_digest = std::array<uint8_t, 16>;
+
+// a file named relative to a directory fd (AT_FDCWD for plain paths)
+struct file_ref
 {
-  // todo: calc md5
-  return "to be determined";
+  int dirfd;
+  const char *path;
+};
+
+// streaming MD5 (RFC 1321)
+class md5_context
+{
+public:
+  md5_context () { reset (); }
+
+  void reset ();
+  void update (const void *data, size_t size);
+  md5_digest final ();
+
+private:
+  uint32_t state_[4];
+  uint64_t length_;
+  uint8_t buffer_[64];
+};
+
+std::string to_hex (const uint8_t *data, size_t size);
+
+template <size_t N>
+std::string
+to_hex (const std::array<uint8_t, N> &data)
+{
+  return to_hex (data.data (), N);
 }
 
+// lowercase hex digest of the file contents, empty if it can't be read
+std::string md5 (const std::string &file_path);
+// false if the file can't be read
+bool md5 (const file_ref &file, md5_digest &digest);
+
+/*
+ * Multi-buffer MD5.
+ *
+ * MD5 is serial within one message, so rather than vectorizing a single
+ * file, 4 (SSE2), 8 (AVX2) or 16 (AVX-512) files are hashed side by side,
+ * one per SIMD lane. The widest kernel the CPU supports is picked at
+ * runtime, capped by `max_lanes` (0: no cap, 1: scalar).
+ *
+ * digests[i] is the digest of files[i], empty if it can't be read.
+ */
+void md5_files (const std::vector<file_ref> &files,
+                std::vector<std::optional<md5_digest>> &digests, unsigned int max_lanes = 0);
+
+// lanes md5_files uses without a cap: 16, 8, 4, or 1 for scalar
+unsigned int md5_mb_lanes ();
+
 } // namespace utils
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstdint>
+
+#include "md5_rounds.hpp"
+
+/*
+ * Multi-buffer MD5 kernels, one translation unit per instruction set
+ * (compiled with the matching -m flags, see CMakeLists.txt).
+ *
+ * Each call runs one 64-byte block for every lane:
+ *   state: a[LANES] b[LANES] c[LANES] d[LANES]
+ *   words: w0[LANES] ... w15[LANES], the little-endian message words
+ *          of each lane's block, transposed
+ */
+
+#if defined(__x86_64__) || defined(__i386__)
+#define HK_MD5_MB_X86 1
+#endif
+
+namespace utils
+{
+namespace detail
+{
+
+using md5_mb_kernel = void (*) (uint32_t *state, const uint32_t *words);
+
+#if defined(HK_MD5_MB_X86)
+void md5_mb_x4_sse2 (uint32_t *state, const uint32_t *words);
+void md5_mb_x8_avx2 (uint32_t *state, const uint32_t *words);
+void md5_mb_x16_avx512 (uint32_t *state, const uint32_t *words);
+#endif
+
+/*
+ * Generic body shared by the kernels. `Ops` wraps one vector type:
+ *   vec, lanes, load, store, add, set1, rotl<s>, F, G, H, I
+ */
+template <typename Ops>
+inline void
+md5_mb_transform (uint32_t *state, const uint32_t *words)
+{
+  using vec = typename Ops::vec;
+  constexpr int L = Ops::lanes;
+
+  vec a = Ops::load (state + 0 * L);
+  vec b = Ops::load (state + 1 * L);
+  vec c = Ops::load (state + 2 * L);
+  vec d = Ops::load (state + 3 * L);
+  const vec aa = a, bb = b, cc = c, dd = d;
+
+#define MD5_MB_STEP(fn, a, b, c, d, x, s, t)                                  \
+  a = Ops::add (                                                              \
+      b, Ops::template rotl<s> (Ops::add (                                    \
+             Ops::add (a, Ops::fn (b, c, d)),                                 \
+             Ops::add (Ops::load (words + (x) * L), Ops::set1 (t)))));
+
+  MD5_ROUNDS (MD5_MB_STEP)
+
+#undef MD5_MB_STEP
+
+  Ops::store (state + 0 * L, Ops::add (a, aa));
+  Ops::store (state + 1 * L, Ops::add (b, bb));
+  Ops::store (state + 2 * L, Ops::add (c, cc));
+  Ops::store (state + 3 * L, Ops::add (d, dd));
+}
+
+} // namespace detail
+} // namespace utils
@@ -0,0 +1,51 @@
+#include "md5_mb.hpp"
+
+#if defined(HK_MD5_MB_X86)
+
+#include <immintrin.h>
+
+namespace utils
+{
+namespace detail
+{
+namespace
+{
+
+struct avx2_ops
+{
+  using vec = __m256i;
+  static constexpr int lanes = 8;
+
+  static vec load (const uint32_t *p) { return _mm256_loadu_si256 (reinterpret_cast<const vec *> (p)); }
+  static void store (uint32_t *p, vec v) { _mm256_storeu_si256 (reinterpret_cast<vec *> (p), v); }
+  static vec add (vec x, vec y) { return _mm256_add_epi32 (x, y); }
+  static vec set1 (uint32_t x) { return _mm256_set1_epi32 (static_cast<int> (x)); }
+
+  template <int S>
+  static vec
+  rotl (vec x)
+  {
+    return _mm256_or_si256 (_mm256_slli_epi32 (x, S), _mm256_srli_epi32 (x, 32 - S));
+  }
+
+  // d ^ (b & (c ^ d))
+  static vec F (vec b, vec c, vec d) { return _mm256_xor_si256 (d, _mm256_and_si256 (b, _mm256_xor_si256 (c, d))); }
+  // c ^ (d & (b ^ c))
+  static vec G (vec b, vec c, vec d) { return _mm256_xor_si256 (c, _mm256_and_si256 (d, _mm256_xor_si256 (b, c))); }
+  static vec H (vec b, vec c, vec d) { return _mm256_xor_si256 (_mm256_xor_si256 (b, c), d); }
+  // c ^ (b | ~d)
+  static vec I (vec b, vec c, vec d) { return _mm256_xor_si256 (c, _mm256_or_si256 (b, _mm256_xor_si256 (d, _mm256_set1_epi32 (-1)))); }
+};
+
+} // namespace
+
+void
+md5_mb_x8_avx2 (uint32_t *state, const uint32_t *words)
+{
+  md5_mb_transform<avx2_ops> (state, words);
+}
+
+} // namespace detail
+} // namespace utils
+
+#endif
@@ -0,0 +1,49 @@
+#include "md5_mb.hpp"
+
+#if defined(HK_MD5_MB_X86)
+
+#include <immintrin.h>
+
+namespace utils
+{
+namespace detail
+{
+namespace
+{
+
+struct avx512_ops
+{
+  using vec = __m512i;
+  static constexpr int lanes = 16;
+
+  static vec load (const uint32_t *p) { return _mm512_loadu_si512 (p); }
+  static void store (uint32_t *p, vec v) { _mm512_storeu_si512 (p, v); }
+  static vec add (vec x, vec y) { return _mm512_add_epi32 (x, y); }
+  static vec set1 (uint32_t x) { return _mm512_set1_epi32 (static_cast<int> (x)); }
+
+  template <int S>
+  static vec
+  rotl (vec x)
+  {
+    return _mm512_rol_epi32 (x, S);
+  }
+
+  // the round functions are single ternary-logic ops, imm8 is the truth table
+  static vec F (vec b, vec c, vec d) { return _mm512_ternarylogic_epi32 (b, c, d, 0xca); }
+  static vec G (vec b, vec c, vec d) { return _mm512_ternarylogic_epi32 (b, c, d, 0xe4); }
+  static vec H (vec b, vec c, vec d) { return _mm512_ternarylogic_epi32 (b, c, d, 0x96); }
+  static vec I (vec b, vec c, vec d) { return _mm512_ternarylogic_epi32 (b, c, d, 0x39); }
+};
+
+} // namespace
+
+void
+md5_mb_x16_avx512 (uint32_t *state, const uint32_t *words)
+{
+  md5_mb_transform<avx512_ops> (state, words);
+}
+
+} // namespace detail
+} // namespace utils
+
+#endif
@@ -0,0 +1,51 @@
+#include "md5_mb.hpp"
+
+#if defined(HK_MD5_MB_X86)
+
+#include <emmintrin.h>
+
+namespace utils
+{
+namespace detail
+{
+namespace
+{
+
+struct sse2_ops
+{
+  using vec = __m128i;
+  static constexpr int lanes = 4;
+
+  static vec load (const uint32_t *p) { return _mm_loadu_si128 (reinterpret_cast<const vec *> (p)); }
+  static void store (uint32_t *p, vec v) { _mm_storeu_si128 (reinterpret_cast<vec *> (p), v); }
+  static vec add (vec x, vec y) { return _mm_add_epi32 (x, y); }
+  static vec set1 (uint32_t x) { return _mm_set1_epi32 (static_cast<int> (x)); }
+
+  template <int S>
+  static vec
+  rotl (vec x)
+  {
+    return _mm_or_si128 (_mm_slli_epi32 (x, S), _mm_srli_epi32 (x, 32 - S));
+  }
+
+  // d ^ (b & (c ^ d))
+  static vec F (vec b, vec c, vec d) { return _mm_xor_si128 (d, _mm_and_si128 (b, _mm_xor_si128 (c, d))); }
+  // c ^ (d & (b ^ c))
+  static vec G (vec b, vec c, vec d) { return _mm_xor_si128 (c, _mm_and_si128 (d, _mm_xor_si128 (b, c))); }
+  static vec H (vec b, vec c, vec d) { return _mm_xor_si128 (_mm_xor_si128 (b, c), d); }
+  // c ^ (b | ~d)
+  static vec I (vec b, vec c, vec d) { return _mm_xor_si128 (c, _mm_or_si128 (b, _mm_xor_si128 (d, _mm_set1_epi32 (-1)))); }
+};
+
+} // namespace
+
+void
+md5_mb_x4_sse2 (uint32_t *state, const uint32_t *words)
+{
+  md5_mb_transform<sse2_ops> (state, words);
+}
+
+} // namespace detail
+} // namespace utils
+
+#endif
@@ -0,0 +1,168 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <utility>
+
+namespace utils
+{
+
+/*
+ * Unbounded lock-free multi-producer / single-consumer queue
+ * (Vyukov's node-based algorithm).
+ *
+ * push() is wait-free and may be called from any thread; pop() and
+ * empty() must only be called from the one consumer thread.
+ *
+ * wait_pop() blocks the consumer until there is something to pop, or
+ * until a deadline with wait_pop_until(). A push only takes the lock
+ * when the consumer is actually asleep.
+ */
+template <typename T>
+class mpsc_queue
+{
+  struct node
+  {
+    std::atomic<node *> next{ nullptr };
+    T value{};
+  };
+
+public:
+  mpsc_queue () : head_{ new node }, tail_{ head_.load () } {}
+
+  ~mpsc_queue ()
+  {
+    T drop{};
+    while (pop (drop))
+      {
+      }
+    delete tail_;
+  }
+
+  mpsc_queue (const mpsc_queue &) = delete;
+  mpsc_queue &operator= (const mpsc_queue &) = delete;
+
+  void
+  push (T value)
+  {
+    node *item = new node;
+    item->value = std::move (value);
+    node *prev = head_.exchange (item, std::memory_order_acq_rel);
+    prev->next.store (item, std::memory_order_release);
+
+    // pairs with the fence in wait_pop: either the consumer sees the
+    // item before sleeping, or we see it asleep
+    std::atomic_thread_fence (std::memory_order_seq_cst);
+    if (sleeping_.load (std::memory_order_relaxed))
+      {
+        std::lock_guard<std::mutex> lock (mutex_);
+        wake_.notify_one ();
+      }
+  }
+
+  // wake wait_pop for good once the queue is drained; any thread
+  void
+  close ()
+  {
+    {
+      std::lock_guard<std::mutex> lock (mutex_);
+      closed_ = true;
+    }
+    wake_.notify_one ();
+  }
+
+  // consumer: false once closed and empty
+  bool
+  wait_pop (T &value)
+  {
+    for (;;)
+      {
+        if (pop (value))
+          {
+            return true;
+          }
+        if (closed_.load ())
+          {
+            // pushes that raced with close ()
+            return pop (value);
+          }
+
+        sleeping_.store (true, std::memory_order_relaxed);
+        std::atomic_thread_fence (std::memory_order_seq_cst);
+        {
+          std::unique_lock<std::mutex> lock (mutex_);
+          wake_.wait (lock, [this] { return !empty () || closed_.load (); });
+        }
+        sleeping_.store (false, std::memory_order_relaxed);
+      }
+  }
+
+  // wait_pop giving up at `deadline`; false then as well, closed () tells
+  template <typename Clock, typename Duration>
+  bool
+  wait_pop_until (T &value, const std::chrono::time_point<Clock, Duration> &deadline)
+  {
+    for (;;)
+      {
+        if (pop (value))
+          {
+            return true;
+          }
+        if (closed_.load ())
+          {
+            return pop (value);
+          }
+
+        sleeping_.store (true, std::memory_order_relaxed);
+        std::atomic_thread_fence (std::memory_order_seq_cst);
+        bool woken;
+        {
+          std::unique_lock<std::mutex> lock (mutex_);
+          woken = wake_.wait_until (lock, deadline,
+                                    [this] { return !empty () || closed_.load (); });
+        }
+        sleeping_.store (false, std::memory_order_relaxed);
+        if (!woken)
+          {
+            return false;
+          }
+      }
+  }
+
+  bool closed () const { return closed_.load (); }
+
+  bool
+  pop (T &value)
+  {
+    node *tail = tail_;
+    node *next = tail->next.load (std::memory_order_acquire);
+    if (next == nullptr)
+      {
+        return false;
+      }
+    value = std::move (next->value);
+    tail_ = next;
+    delete tail;
+    return true;
+  }
+
+  // a push in progress may not be visible yet
+  bool
+  empty () const
+  {
+    return tail_->next.load (std::memory_order_acquire) == nullptr;
+  }
+
+private:
+  std::atomic<node *> head_;
+  node *tail_;
+
+  std::atomic_bool sleeping_{};
+  std::atomic_bool closed_{};
+  std::mutex mutex_;
+  std::condition_variable wake_;
+};
+
+} // namespace utils
@@ -0,0 +1,190 @@
+#include "sha256.hpp"
+
+#include <cstring>
+
+namespace utils
+{
+namespace detail
+{
+
+const uint32_t SHA256_K[64] = {
+  0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+  0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+  0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+  0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+  0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+  0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+  0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+  0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+namespace
+{
+
+inline uint32_t rotr32 (uint32_t x, int s) { return (x >> s) | (x << (32 - s)); }
+
+inline uint32_t
+load_be32 (const uint8_t *p)
+{
+  return static_cast<uint32_t> (p[0]) << 24 | static_cast<uint32_t> (p[1]) << 16
+         | static_cast<uint32_t> (p[2]) << 8 | static_cast<uint32_t> (p[3]);
+}
+
+inline void
+store_be32 (uint8_t *p, uint32_t v)
+{
+  p[0] = static_cast<uint8_t> (v >> 24);
+  p[1] = static_cast<uint8_t> (v >> 16);
+  p[2] = static_cast<uint8_t> (v >> 8);
+  p[3] = static_cast<uint8_t> (v);
+}
+
+sha256_compress_fn
+select_compress ()
+{
+#if defined(HK_SHA256_X86)
+  // same detection as the md5 multi-buffer kernels
+  __builtin_cpu_init ();
+  if (__builtin_cpu_supports ("ssse3") && __builtin_cpu_supports ("sse4.1")
+      && __builtin_cpu_supports ("sha"))
+    {
+      return &sha256_compress_shani;
+    }
+#endif
+  return &sha256_compress_generic;
+}
+
+// picked once, on first use
+sha256_compress_fn
+sha256_compress ()
+{
+  static const sha256_compress_fn compress = select_compress ();
+  return compress;
+}
+
+} // namespace
+
+void
+sha256_compress_generic (uint32_t state[8], const uint8_t *data, size_t blocks)
+{
+  uint32_t w[64];
+  for (; blocks > 0; --blocks, data += 64)
+    {
+      for (int i = 0; i < 16; ++i)
+        {
+          w[i] = load_be32 (data + 4 * i);
+        }
+      for (int i = 16; i < 64; ++i)
+        {
+          const uint32_t s0 = rotr32 (w[i - 15], 7) ^ rotr32 (w[i - 15], 18) ^ (w[i - 15] >> 3);
+          const uint32_t s1 = rotr32 (w[i - 2], 17) ^ rotr32 (w[i - 2], 19) ^ (w[i - 2] >> 10);
+          w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+        }
+
+      uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+      uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+      for (int i = 0; i < 64; ++i)
+        {
+          const uint32_t s1 = rotr32 (e, 6) ^ rotr32 (e, 11) ^ rotr32 (e, 25);
+          const uint32_t ch = (e & f) ^ (~e & g);
+          const uint32_t t1 = h + s1 + ch + SHA256_K[i] + w[i];
+          const uint32_t s0 = rotr32 (a, 2) ^ rotr32 (a, 13) ^ rotr32 (a, 22);
+          const uint32_t maj = (a & b) ^ (a & c) ^ (b & c);
+          const uint32_t t2 = s0 + maj;
+          h = g;
+          g = f;
+          f = e;
+          e = d + t1;
+          d = c;
+          c = b;
+          b = a;
+          a = t1 + t2;
+        }
+
+      state[0] += a;
+      state[1] += b;
+      state[2] += c;
+      state[3] += d;
+      state[4] += e;
+      state[5] += f;
+      state[6] += g;
+      state[7] += h;
+    }
+}
+
+} // namespace detail
+
+void
+sha256_context::reset ()
+{
+  static const uint32_t iv[8] = { 0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+                                  0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19 };
+  std::memcpy (state_, iv, sizeof (state_));
+  length_ = 0;
+}
+
+void
+sha256_context::update (const void *data, size_t size)
+{
+  const auto *input = static_cast<const uint8_t *> (data);
+  const size_t used = static_cast<size_t> (length_ % 64);
+  length_ += size;
+
+  if (used != 0)
+    {
+      const size_t fill = size < 64 - used ? size : 64 - used;
+      std::memcpy (buffer_ + used, input, fill);
+      input += fill;
+      size -= fill;
+      if (used + fill < 64)
+        {
+          return;
+        }
+      detail::sha256_compress () (state_, buffer_, 1);
+    }
+
+  if (size >= 64)
+    {
+      detail::sha256_compress () (state_, input, size / 64);
+      input += size & ~static_cast<size_t> (63);
+      size %= 64;
+    }
+
+  std::memcpy (buffer_, input, size);
+}
+
+sha256_digest
+sha256_context::final ()
+{
+  const uint64_t bit_length = length_ * 8;
+  const size_t used = static_cast<size_t> (length_ % 64);
+
+  uint8_t padding[128] = { 0x80 };
+  const size_t pad_size = (used < 56 ? 56 : 120) - used;
+  update (padding, pad_size);
+
+  uint8_t length_be[8];
+  detail::store_be32 (length_be, static_cast<uint32_t> (bit_length >> 32));
+  detail::store_be32 (length_be + 4, static_cast<uint32_t> (bit_length));
+  update (length_be, sizeof (length_be));
+
+  sha256_digest digest;
+  for (int i = 0; i < 8; ++i)
+    {
+      detail::store_be32 (digest.data () + 4 * i, state_[i]);
+    }
+  reset ();
+  return digest;
+}
+
+bool
+sha256_context::accelerated ()
+{
+#if defined(HK_SHA256_X86)
+  return detail::sha256_compress () == &detail::sha256_compress_shani;
+#else
+  return false;
+#endif
+}
+
+} // namespace utils
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+namespace utils
+{
+
+using sha256_digest = std::array<uint8_t, 32>;
+
+namespace detail
+{
+
+// round constants, shared with the SHA-NI kernel
+extern const uint32_t SHA256_K[64];
+
+// compress `blocks` consecutive 64-byte blocks into `state`
+using sha256_compress_fn = void (*) (uint32_t state[8], const uint8_t *data,
+                                     size_t blocks);
+
+void sha256_compress_generic (uint32_t state[8], const uint8_t *data,
+                              size_t blocks);
+
+#if defined(__x86_64__) || defined(__i386__)
+#define HK_SHA256_X86 1
+// Intel SHA extensions (SHA-NI), needs SSSE3/SSE4.1 as well
+void sha256_compress_shani (uint32_t state[8], const uint8_t *data,
+                            size_t blocks);
+#endif
+
+} // namespace detail
+
+// streaming SHA-256 (FIPS 180-4), SHA-NI accelerated when the CPU has it
+class sha256_context
+{
+public:
+  sha256_context () { reset (); }
+
+  void reset ();
+  void update (const void *data, size_t size);
+  sha256_digest final ();
+
+  // true if the SHA-NI kernel is in use
+  static bool accelerated ();
+
+private:
+  uint32_t state_[8];
+  uint64_t length_;
+  uint8_t buffer_[64];
+};
+
+} // namespace utils
@@ -0,0 +1,86 @@
+#include "sha256.hpp"
+
+#if defined(HK_SHA256_X86)
+
+#include <immintrin.h>
+
+namespace utils
+{
+namespace detail
+{
+
+/*
+ * SHA-256 on the Intel SHA extensions. The state is kept as ABEF/CDGH
+ * halves as sha256rnds2 expects; each iteration of the group loop does
+ * four rounds and advances the message schedule with msg1/msg2.
+ */
+void
+sha256_compress_shani (uint32_t state[8], const uint8_t *data, size_t blocks)
+{
+  const __m128i byteswap
+      = _mm_set_epi64x (0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+
+  __m128i tmp = _mm_loadu_si128 (reinterpret_cast<const __m128i *> (&state[0]));
+  __m128i state1 = _mm_loadu_si128 (reinterpret_cast<const __m128i *> (&state[4]));
+
+  tmp = _mm_shuffle_epi32 (tmp, 0xb1);                  // CDAB
+  state1 = _mm_shuffle_epi32 (state1, 0x1b);            // EFGH
+  __m128i state0 = _mm_alignr_epi8 (tmp, state1, 8);    // ABEF
+  state1 = _mm_blend_epi16 (state1, tmp, 0xf0);         // CDGH
+
+  for (; blocks > 0; --blocks, data += 64)
+    {
+      const __m128i abef_save = state0;
+      const __m128i cdgh_save = state1;
+      __m128i msg[4];
+
+      for (int g = 0; g < 16; ++g)
+        {
+          __m128i &cur = msg[g & 3];
+          if (g < 4)
+            {
+              cur = _mm_shuffle_epi8 (
+                  _mm_loadu_si128 (reinterpret_cast<const __m128i *> (data + 16 * g)),
+                  byteswap);
+            }
+
+          __m128i wk = _mm_add_epi32 (
+              cur, _mm_loadu_si128 (reinterpret_cast<const __m128i *> (&SHA256_K[4 * g])));
+          state1 = _mm_sha256rnds2_epu32 (state1, state0, wk);
+
+          // finish the schedule words of group g + 1
+          if (g >= 3 && g <= 14)
+            {
+              __m128i &next = msg[(g + 1) & 3];
+              next = _mm_add_epi32 (next, _mm_alignr_epi8 (cur, msg[(g - 1) & 3], 4));
+              next = _mm_sha256msg2_epu32 (next, cur);
+            }
+
+          wk = _mm_shuffle_epi32 (wk, 0x0e);
+          state0 = _mm_sha256rnds2_epu32 (state0, state1, wk);
+
+          // start the schedule words of group g + 3
+          if (g >= 1 && g <= 12)
+            {
+              __m128i &prev = msg[(g - 1) & 3];
+              prev = _mm_sha256msg1_epu32 (prev, cur);
+            }
+        }
+
+      state0 = _mm_add_epi32 (state0, abef_save);
+      state1 = _mm_add_epi32 (state1, cdgh_save);
+    }
+
+  tmp = _mm_shuffle_epi32 (state0, 0x1b);               // FEBA
+  state1 = _mm_shuffle_epi32 (state1, 0xb1);            // DCHG
+  state0 = _mm_blend_epi16 (tmp, state1, 0xf0);         // DCBA
+  state1 = _mm_alignr_epi8 (state1, tmp, 8);            // ABEF
+
+  _mm_storeu_si128 (reinterpret_cast<__m128i *> (&state[0]), state0);
+  _mm_storeu_si128 (reinterpret_cast<__m128i *> (&state[4]), state1);
+}
+
+} // namespace detail
+} // namespace utils
+
+#endif
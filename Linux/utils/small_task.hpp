@@ -0,0 +1,121 @@
+#pragma once
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace utils
+{
+
+/*
+ * Move-only void() callable, like a std::function that can't be copied.
+ * A callable up to InlineSize bytes is stored in place: no allocation
+ * to create, move or run it, which is the common case for pool tasks
+ * (a pointer, a path and a shared_ptr). Bigger ones go to the heap.
+ */
+template <size_t InlineSize>
+class small_task
+{
+public:
+  small_task () noexcept = default;
+  small_task (std::nullptr_t) noexcept {}
+
+  template <typename F,
+            typename = std::enable_if_t<!std::is_same<std::decay_t<F>, small_task>::value>>
+  small_task (F &&callable)
+  {
+    using stored = std::decay_t<F>;
+    if constexpr (stored_inline<stored>)
+      {
+        ::new (static_cast<void *> (storage_)) stored (std::forward<F> (callable));
+        ops_ = &inline_ops<stored>;
+      }
+    else
+      {
+        ::new (static_cast<void *> (storage_)) stored *(new stored (std::forward<F> (callable)));
+        ops_ = &heap_ops<stored>;
+      }
+  }
+
+  small_task (small_task &&other) noexcept { take (other); }
+  small_task &
+  operator= (small_task &&other) noexcept
+  {
+    if (this != &other)
+      {
+        reset ();
+        take (other);
+      }
+    return *this;
+  }
+  small_task &
+  operator= (std::nullptr_t) noexcept
+  {
+    reset ();
+    return *this;
+  }
+  small_task (small_task const &) = delete;
+  small_task &operator= (small_task const &) = delete;
+
+  ~small_task () { reset (); }
+
+  explicit operator bool () const noexcept { return ops_ != nullptr; }
+  void operator() () { ops_->invoke (storage_); }
+
+private:
+  struct operations
+  {
+    void (*invoke) (void *storage);
+    // move-constructs into `to` and destroys `from`
+    void (*relocate) (void *to, void *from) noexcept;
+    void (*destroy) (void *storage) noexcept;
+  };
+
+  template <typename F>
+  static constexpr bool stored_inline = sizeof (F) <= InlineSize
+                                        && alignof (F) <= alignof (std::max_align_t)
+                                        && std::is_nothrow_move_constructible<F>::value;
+
+  template <typename F>
+  static constexpr operations inline_ops = {
+    [] (void *storage) { (*static_cast<F *> (storage)) (); },
+    [] (void *to, void *from) noexcept {
+      ::new (to) F (std::move (*static_cast<F *> (from)));
+      static_cast<F *> (from)->~F ();
+    },
+    [] (void *storage) noexcept { static_cast<F *> (storage)->~F (); },
+  };
+
+  template <typename F>
+  static constexpr operations heap_ops = {
+    [] (void *storage) { (**static_cast<F **> (storage)) (); },
+    [] (void *to, void *from) noexcept { ::new (to) F *(*static_cast<F **> (from)); },
+    [] (void *storage) noexcept { delete *static_cast<F **> (storage); },
+  };
+
+  void
+  take (small_task &other) noexcept
+  {
+    if (other.ops_ != nullptr)
+      {
+        other.ops_->relocate (storage_, other.storage_);
+        ops_ = std::exchange (other.ops_, nullptr);
+      }
+  }
+
+  void
+  reset () noexcept
+  {
+    if (ops_ != nullptr)
+      {
+        std::exchange (ops_, nullptr)->destroy (storage_);
+      }
+  }
+
+private:
+  alignas (std::max_align_t) unsigned char storage_[InlineSize];
+  const operations *ops_{};
+};
+
+} // namespace utils
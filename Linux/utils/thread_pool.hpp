@@ -1,15 +1,20 @@
 #pragma once 
 
+#include <algorithm>
 #include <thread>
 #include <condition_variable>
 #include <mutex>
 #include <type_traits>
-#include <queue>
+#include <deque>
 #include <memory>
 #include <atomic>
 #include <functional>
+#include <future>
+#include <iterator>
 #include <fmt/core.h>
 
+#include "small_task.hpp"
+
 // todo: remove logs when it's stable
 namespace utils
 {
@@ -18,13 +23,114 @@ using namespace std::chrono_literals;
 
 using concurrency_t = std::result_of_t<decltype(&std::thread::hardware_concurrency)()>;
 constexpr concurrency_t DEFAULT_THREAD_COUNT = 3;
+// an I/O-bound pool waits more than it computes: room for this many
+// workers per core, never less than MIN_MAX_THREAD_COUNT
+constexpr concurrency_t MAX_THREADS_PER_CORE = 8;
+constexpr concurrency_t MIN_MAX_THREAD_COUNT = 16;
+
+// what the pool queues: a do_scan call (this, a path, a parent dir) fits
+// in place, and so does a device queue's wrapper around a device_task
+using task_function = small_task<96>;
+
+// order a worker runs its own tasks in; steals always take the oldest
+enum class task_order
+{
+  LIFO,
+  FIFO
+};
+
+class thread_pool;
+
+/*
+ * Tasks of one job (a scan, a batch of hashes) on a pool that may run
+ * other jobs' tasks too: waited on, polled and cancelled on their own.
+ * Must outlive its tasks; the destructor waits for them.
+ */
+class task_group
+{
+public:
+  task_group () = default;
+  ~task_group () { wait (); }
+
+  task_group (const task_group&) = delete;
+  task_group& operator= (const task_group&) = delete;
+
+  // pushed and not done yet, running ones included
+  size_t get_tasks_count () const
+  {
+    return tasks_total_;
+  }
+
+  bool idle () const
+  {
+    return tasks_total_ == 0;
+  }
+
+  // until every task pushed so far is done, or dropped by cancel ()
+  void wait ()
+  {
+    std::unique_lock<std::mutex> done_lock (done_mutex_);
+    task_done_cv_.wait (done_lock, [this] { return tasks_total_ == 0; });
+  }
 
+  // tasks not started yet are dropped when their turn comes, a future
+  // from submit () then holds std::future_error (broken_promise)
+  void cancel ()
+  {
+    cancelled_ = true;
+  }
+
+  bool is_cancelled () const
+  {
+    return cancelled_;
+  }
+
+private:
+  friend class thread_pool;
+
+  void task_added (size_t count)
+  {
+    tasks_total_ += count;
+  }
+
+  void task_done ()
+  {
+    // under the lock: wait () may return and destroy us right after
+    std::lock_guard<std::mutex> done_lock (done_mutex_);
+    if (--tasks_total_ == 0)
+      task_done_cv_.notify_all ();
+  }
+
+private:
+  std::atomic<size_t> tasks_total_ {};
+  std::atomic_bool cancelled_ {};
+  std::mutex done_mutex_;
+  std::condition_variable task_done_cv_;
+};
+
+/*
+ * Work-stealing pool: every worker owns a deque. Tasks pushed from a
+ * worker go to its own deque and are popped LIFO by that worker (depth
+ * first, cache warm); idle workers steal FIFO from the other end of their
+ * siblings' deques. Tasks pushed from outside the pool are spread round
+ * robin. There is no pool-wide queue lock on the hot path.
+ *
+ * Several jobs can share one pool, sized to the machine, each pushing
+ * into its own task_group.
+ *
+ * The worker count can change while tasks run, up to a maximum fixed at
+ * construction (max_thread_count, 0: 8 per core): extra workers start
+ * right away, surplus ones leave after their current task. A departed
+ * worker's deque is still stolen from.
+ */
 class thread_pool
 {
 public:
-  explicit thread_pool (concurrency_t thread_count)
-      : thread_count_{ determine_thread_count(thread_count) }, 
-        threads_{ std::make_unique<std::thread[]> (thread_count_) }
+  explicit thread_pool (concurrency_t thread_count, concurrency_t max_thread_count = 0)
+      : max_threads_{ determine_max_threads (max_thread_count) },
+        thread_count_{ determine_thread_count(thread_count) },
+        threads_{ std::make_unique<std::thread[]> (max_threads_) },
+        queues_{ std::make_unique<worker_queue[]> (max_threads_) }
   {
     create_threads();
   }
@@ -41,12 +147,21 @@ public:
   void pause()
   {
     paused_ = true;
-    fmt::print("paused, tasks_total: {}, queued: {}\n", tasks_total_, tasks_.size());
+    fmt::print("paused, tasks_total: {}, queued: {}\n", tasks_total_, tasks_queued_);
+    {
+      // queued tasks no longer count for wait_for_tasks
+      std::lock_guard<std::mutex> done_lock (done_mutex_);
+    }
+    task_done_cv_.notify_all ();
   }
 
   void unpause()
   {
-    paused_ = false;
+    {
+      std::lock_guard<std::mutex> idle_lock (idle_mutex_);
+      paused_ = false;
+    }
+    task_available_cv_.notify_all ();
   }
 
   bool is_paused() const
@@ -54,16 +169,19 @@ public:
     return paused_;
   }
 
+  void set_task_order(task_order order)
+  {
+    order_ = order;
+  }
+
   size_t get_task_queued() const
   {
-    std::unique_lock<std::mutex> tasks_lock(tasks_mutex_);
-    return tasks_.size();
+    return tasks_queued_;
   }
 
   size_t get_tasks_running() const
   {
-    std::unique_lock<std::mutex> tasks_lock(tasks_mutex_);
-    return tasks_total_ - tasks_.size();
+    return tasks_total_ - tasks_queued_;
   }
 
   size_t get_thread_count() const
@@ -71,29 +189,98 @@ public:
     return thread_count_;
   }
 
+  size_t get_max_thread_count() const
+  {
+    return max_threads_;
+  }
+
+  // grow or shrink to `thread_count` workers, clamped to [1, max]
+  void set_thread_count(concurrency_t thread_count)
+  {
+    thread_count = std::max<concurrency_t> (1, std::min (thread_count, max_threads_));
+    std::lock_guard<std::mutex> resize_lock (resize_mutex_);
+    const concurrency_t previous = thread_count_.exchange (thread_count);
+    if (thread_count > previous)
+    {
+      if (thread_count > queue_count_)
+        queue_count_ = thread_count;
+      for (concurrency_t i = 0; i < thread_count; ++i)
+        start_worker (i);
+    }
+    else if (thread_count < previous)
+    {
+      // idle ones above the count wake up to leave
+      std::lock_guard<std::mutex> idle_lock (idle_mutex_);
+      task_available_cv_.notify_all ();
+    }
+  }
+
   size_t get_tasks_count() const
   {
     return tasks_total_;
   }
 
-  template<typename F, typename...Args>
-  void push_task(F&& task, Args&&...args)
+  // one pool for the whole process, made on first use and
+  // freed with its last user
+  static std::shared_ptr<thread_pool> shared ()
   {
-    std::function<void()> task_function = std::bind(std::forward<F>(task), std::forward<Args>(args)...);
+    static std::mutex shared_mutex;
+    static std::weak_ptr<thread_pool> instance;
+    std::lock_guard<std::mutex> shared_lock (shared_mutex);
+    auto pool = instance.lock ();
+    if (!pool)
     {
-      std::unique_lock<std::mutex> tasks_lock(tasks_mutex_);
-      tasks_.push(task_function);
-      ++tasks_total_;
+      pool = std::make_shared<thread_pool> (std::thread::hardware_concurrency ());
+      instance = pool;
     }
-    task_available_cv_.notify_one();
+    return pool;
+  }
+
+  template<typename F, typename...Args>
+  void push_task(F&& task, Args&&...args)
+  {
+    push_to_group (nullptr, std::forward<F> (task), std::forward<Args> (args)...);
+  }
+
+  template<typename F, typename...Args>
+  void push_task(task_group& group, F&& task, Args&&...args)
+  {
+    push_to_group (&group, std::forward<F> (task), std::forward<Args> (args)...);
+  }
+
+  // a range of task_function (or anything it is built from), moved into
+  // one deque under one lock; idle siblings steal their share from there
+  template<typename Iterator>
+  void push_tasks(Iterator first, Iterator last)
+  {
+    push_range (nullptr, first, last);
+  }
+
+  template<typename Iterator>
+  void push_tasks(task_group& group, Iterator first, Iterator last)
+  {
+    push_range (&group, first, last);
+  }
+
+  // the result, or the exception, comes back through the future
+  template<typename F, typename...Args>
+  auto submit(F&& task, Args&&...args)
+  {
+    return submit_to_group (nullptr, std::forward<F> (task), std::forward<Args> (args)...);
+  }
+
+  template<typename F, typename...Args>
+  auto submit(task_group& group, F&& task, Args&&...args)
+  {
+    return submit_to_group (&group, std::forward<F> (task), std::forward<Args> (args)...);
   }
 
   void wait_for_tasks()
   {
     waiting_ = true;
-    std::unique_lock<std::mutex> tasks_lock(tasks_mutex_);
+    std::unique_lock<std::mutex> done_lock(done_mutex_);
     fmt::print("wait for tasks end\n");
-    task_done_cv_.wait (tasks_lock, [this] { return tasks_total_ == (paused_ ? tasks_.size () : 0); });
+    task_done_cv_.wait (done_lock, [this] { return tasks_total_ == (paused_ ? tasks_queued_.load () : 0); });
     fmt::print("tasks end\n");
     waiting_ = false;
   }
@@ -103,20 +290,178 @@ public:
   thread_pool& operator=(const thread_pool&) = delete;
 
 private:
+  struct queued_task
+  {
+    queued_task (task_function&& task, task_group* group)
+        : function{ std::move (task) }, group{ group }
+    {
+    }
+
+    task_function function;
+    task_group* group;
+  };
+
+  struct worker_queue
+  {
+    std::mutex mutex;
+    std::deque<queued_task> tasks;
+    // its worker runs, under resize_mutex_
+    bool alive {};
+  };
+
+  template<typename F, typename...Args>
+  void push_to_group(task_group* group, F&& task, Args&&...args)
+  {
+    task_function function;
+    if constexpr (sizeof...(Args) == 0)
+      function = task_function (std::forward<F>(task));
+    else
+      function = task_function (std::bind(std::forward<F>(task), std::forward<Args>(args)...));
+    // counted before it is visible, so waiters never observe a false zero
+    if (group)
+      group->task_added (1);
+    ++tasks_total_;
+    ++tasks_queued_;
+    {
+      worker_queue &queue = queues_[target_queue ()];
+      std::lock_guard<std::mutex> queue_lock (queue.mutex);
+      queue.tasks.emplace_back (std::move (function), group);
+    }
+    wake_workers (1);
+  }
+
+  template<typename Iterator>
+  void push_range(task_group* group, Iterator first, Iterator last)
+  {
+    const auto count = static_cast<size_t> (std::distance (first, last));
+    if (count == 0)
+      return;
+    if (group)
+      group->task_added (count);
+    tasks_total_ += count;
+    tasks_queued_ += count;
+    {
+      worker_queue &queue = queues_[target_queue ()];
+      std::lock_guard<std::mutex> queue_lock (queue.mutex);
+      for (; first != last; ++first)
+        queue.tasks.emplace_back (task_function (std::move (*first)), group);
+    }
+    wake_workers (count);
+  }
+
+  template<typename F, typename...Args>
+  auto submit_to_group(task_group* group, F&& task, Args&&...args)
+  {
+    using result_t = std::invoke_result_t<std::decay_t<F>, std::decay_t<Args>...>;
+    std::packaged_task<result_t ()> packaged (
+        std::bind (std::forward<F> (task), std::forward<Args> (args)...));
+    auto result = packaged.get_future ();
+    push_to_group (group, std::move (packaged));
+    return result;
+  }
+
+  // which pool/queue the calling thread works for, if any
+  struct worker_slot
+  {
+    const thread_pool *pool;
+    concurrency_t index;
+  };
+
+  static worker_slot &this_worker ()
+  {
+    static thread_local worker_slot slot{ nullptr, 0 };
+    return slot;
+  }
+
+  concurrency_t target_queue ()
+  {
+    const worker_slot &slot = this_worker ();
+    if (slot.pool == this)
+      return slot.index;
+    return next_queue_.fetch_add (1, std::memory_order_relaxed) % thread_count_.load ();
+  }
+
+  void wake_workers (size_t count)
+  {
+    if (idle_workers_ > 0)
+    {
+      std::lock_guard<std::mutex> idle_lock (idle_mutex_);
+      if (count > 1)
+        task_available_cv_.notify_all ();
+      else
+        task_available_cv_.notify_one ();
+    }
+  }
+
+  bool pop_task (concurrency_t index, task_function &task, task_group *&group)
+  {
+    // own deque: newest first unless asked otherwise
+    {
+      worker_queue &own = queues_[index];
+      std::lock_guard<std::mutex> queue_lock (own.mutex);
+      if (!own.tasks.empty ())
+      {
+        queued_task &next = order_ == task_order::LIFO ? own.tasks.back () : own.tasks.front ();
+        task = std::move (next.function);
+        group = next.group;
+        if (order_ == task_order::LIFO)
+          own.tasks.pop_back ();
+        else
+          own.tasks.pop_front ();
+        return true;
+      }
+    }
+
+    // steal: oldest first, the victim keeps working on its hot end;
+    // deques of workers gone after a shrink are swept too
+    const concurrency_t queue_count = queue_count_;
+    for (concurrency_t i = 1; i < queue_count; ++i)
+    {
+      worker_queue &victim = queues_[(index + i) % queue_count];
+      std::lock_guard<std::mutex> queue_lock (victim.mutex);
+      if (!victim.tasks.empty ())
+      {
+        task = std::move (victim.tasks.front ().function);
+        group = victim.tasks.front ().group;
+        victim.tasks.pop_front ();
+        return true;
+      }
+    }
+    return false;
+  }
+
   void create_threads()
   {
     running_ = true;
+    queue_count_ = thread_count_.load ();
+    std::lock_guard<std::mutex> resize_lock (resize_mutex_);
     for(concurrency_t i = 0; i < thread_count_; ++i)
     {
-      threads_[i] = std::thread(&thread_pool::worker, this);
+      start_worker (i);
     }
   }
 
+  // under resize_mutex_
+  void start_worker(concurrency_t index)
+  {
+    worker_queue &queue = queues_[index];
+    if (queue.alive)
+      return;
+    // a worker that left earlier: it is past its last access to the pool
+    if (threads_[index].joinable ())
+      threads_[index].join ();
+    queue.alive = true;
+    threads_[index] = std::thread(&thread_pool::worker, this, index);
+  }
+
   void destroy_threads ()
   {
-    running_ = false;
+    {
+      std::lock_guard<std::mutex> idle_lock (idle_mutex_);
+      running_ = false;
+    }
     task_available_cv_.notify_all ();
-    for (concurrency_t i = 0; i < thread_count_; ++i)
+    for (concurrency_t i = 0; i < max_threads_; ++i)
     {
       if (threads_[i].joinable ())
         {
@@ -125,51 +470,83 @@ private:
     }
   }
 
-  void worker()
+  void worker(concurrency_t index)
   {
     fmt::print("pool worker starting...\n");
-    while(running_)
-    {
-      std::function<void()> task;
-      std::unique_lock<std::mutex> tasks_lock(tasks_mutex_);
-      if(!running_) break;
-      task_available_cv_.wait_until(tasks_lock, std::chrono::steady_clock::now() + 50ms, [this] { return !tasks_.empty () || !running_; });
-      // task_available_cv_.wait(tasks_lock, [this] { return !tasks_.empty () || !running_; });
-      if(running_ && !paused_)
+    this_worker () = { this, index };
+    for (;;)
+    {
+      work (index);
+      // set_thread_count may have taken us back in meanwhile
+      std::lock_guard<std::mutex> resize_lock (resize_mutex_);
+      if (!running_ || index >= thread_count_)
+      {
+        queues_[index].alive = false;
+        break;
+      }
+    }
+    this_worker () = { nullptr, 0 };
+    fmt::print("pool worker ending...\n");
+  }
+
+  void work(concurrency_t index)
+  {
+    while(running_ && index < thread_count_)
+    {
+      task_function task;
+      task_group *group = nullptr;
+      if (paused_ || !pop_task (index, task, group))
+      {
+        std::unique_lock<std::mutex> idle_lock (idle_mutex_);
+        ++idle_workers_;
+        // push_task counts the task before it checks for idle workers,
+        // so a worker can sleep until woken, with no timeout
+        task_available_cv_.wait(idle_lock, [this, index] {
+          return (tasks_queued_ > 0 && !paused_) || !running_ || index >= thread_count_;
+        });
+        --idle_workers_;
+        continue;
+      }
+      --tasks_queued_;
+
+      if (!group || !group->is_cancelled ())
       {
-        if (tasks_.empty()) continue;
-        task = std::move(tasks_.front());
-        tasks_.pop();
-        tasks_lock.unlock();
         try {
           task();
         }
         catch(std::exception& e) {
           fmt::print("error occour: {}\n", e.what());
         }
-        tasks_lock.lock();
-        --tasks_total_;
-        if(waiting_)
-          task_done_cv_.notify_one();
+      }
+      // whatever the task holds goes before its group is told
+      task = nullptr;
+      if (group)
+        group->task_done ();
+
+      --tasks_total_;
+      if(waiting_)
+      {
+        std::lock_guard<std::mutex> done_lock (done_mutex_);
+        task_done_cv_.notify_one();
       }
     }
-    fmt::print("pool worker ending...\n");
   }
 
-  concurrency_t determine_thread_count (concurrency_t t_count)
+  // not capped to the cores: I/O-bound tasks mostly wait
+  concurrency_t determine_thread_count (concurrency_t t_count) const
   {
     if(t_count == 0)
       t_count = DEFAULT_THREAD_COUNT;
 
-    if (std::thread::hardware_concurrency () > 0)
-    {
-      if (t_count > std::thread::hardware_concurrency ())
-        t_count = std::thread::hardware_concurrency ();
-    }
-    else
-      t_count = 1;
+    return std::min (t_count, max_threads_);
+  }
 
-    return t_count;
+  static concurrency_t determine_max_threads (concurrency_t max_count)
+  {
+    if (max_count != 0)
+      return max_count;
+    return std::max (MIN_MAX_THREAD_COUNT,
+                     std::thread::hardware_concurrency () * MAX_THREADS_PER_CORE);
   }
 
 
@@ -177,15 +554,26 @@ private:
   std::atomic_bool running_ {};
   std::atomic_bool waiting_ {};
   std::atomic_bool paused_ {};
+  std::atomic<task_order> order_ { task_order::LIFO };
 
-  concurrency_t thread_count_ ;
+  const concurrency_t max_threads_;
+  std::atomic<concurrency_t> thread_count_;
+  // deques that may hold tasks: every worker that ever ran
+  std::atomic<concurrency_t> queue_count_ {};
+  std::mutex resize_mutex_;
   std::unique_ptr<std::thread[]> threads_ = nullptr;
 
-  mutable std::mutex tasks_mutex_;
+  std::unique_ptr<worker_queue[]> queues_ = nullptr;
+  std::atomic<concurrency_t> next_queue_ {};
+
+  std::mutex idle_mutex_;
   std::condition_variable task_available_cv_;
+  std::atomic<concurrency_t> idle_workers_ {};
+
+  std::mutex done_mutex_;
   std::condition_variable task_done_cv_;
 
-  std::queue<std::function<void()>> tasks_;
+  std::atomic<size_t> tasks_queued_ {};
   std::atomic<size_t> tasks_total_ {};
 
 };
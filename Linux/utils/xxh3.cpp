@@ -0,0 +1,336 @@
+#include "xxh3.hpp"
+
+#include <cstring>
+
+namespace utils
+{
+namespace
+{
+
+constexpr uint32_t PRIME32_1 = 0x9e3779b1U;
+constexpr uint32_t PRIME32_2 = 0x85ebca77U;
+constexpr uint32_t PRIME32_3 = 0xc2b2ae3dU;
+constexpr uint64_t PRIME64_1 = 0x9e3779b185ebca87ULL;
+constexpr uint64_t PRIME64_2 = 0xc2b2ae3d27d4eb4fULL;
+constexpr uint64_t PRIME64_3 = 0x165667b19e3779f9ULL;
+constexpr uint64_t PRIME64_4 = 0x85ebca77c2b2ae63ULL;
+constexpr uint64_t PRIME64_5 = 0x27d4eb2f165667c5ULL;
+constexpr uint64_t PRIME_MX1 = 0x165667919e3779f9ULL;
+constexpr uint64_t PRIME_MX2 = 0x9fb21c651e98df25ULL;
+
+constexpr size_t SECRET_SIZE = 192;
+constexpr size_t STRIPES_PER_BLOCK = (SECRET_SIZE - 64) / 8;
+constexpr size_t MIDSIZE_MAX = 240;
+constexpr size_t MIDSIZE_START_OFFSET = 3;
+constexpr size_t MIDSIZE_LAST_OFFSET = 17;
+constexpr size_t SECRET_SIZE_MIN = 136;
+constexpr size_t SECRET_LASTACC_START = 7;
+constexpr size_t SECRET_MERGEACCS_START = 11;
+
+// the default secret of the reference implementation
+alignas (64) constexpr uint8_t SECRET[SECRET_SIZE] = {
+  0xb8, 0xfe, 0x6c, 0x39, 0x23, 0xa4, 0x4b, 0xbe, 0x7c, 0x01, 0x81, 0x2c, 0xf7, 0x21, 0xad, 0x1c,
+  0xde, 0xd4, 0x6d, 0xe9, 0x83, 0x90, 0x97, 0xdb, 0x72, 0x40, 0xa4, 0xa4, 0xb7, 0xb3, 0x67, 0x1f,
+  0xcb, 0x79, 0xe6, 0x4e, 0xcc, 0xc0, 0xe5, 0x78, 0x82, 0x5a, 0xd0, 0x7d, 0xcc, 0xff, 0x72, 0x21,
+  0xb8, 0x08, 0x46, 0x74, 0xf7, 0x43, 0x24, 0x8e, 0xe0, 0x35, 0x90, 0xe6, 0x81, 0x3a, 0x26, 0x4c,
+  0x3c, 0x28, 0x52, 0xbb, 0x91, 0xc3, 0x00, 0xcb, 0x88, 0xd0, 0x65, 0x8b, 0x1b, 0x53, 0x2e, 0xa3,
+  0x71, 0x64, 0x48, 0x97, 0xa2, 0x0d, 0xf9, 0x4e, 0x38, 0x19, 0xef, 0x46, 0xa9, 0xde, 0xac, 0xd8,
+  0xa8, 0xfa, 0x76, 0x3f, 0xe3, 0x9c, 0x34, 0x3f, 0xf9, 0xdc, 0xbb, 0xc7, 0xc7, 0x0b, 0x4f, 0x1d,
+  0x8a, 0x51, 0xe0, 0x4b, 0xcd, 0xb4, 0x59, 0x31, 0xc8, 0x9f, 0x7e, 0xc9, 0xd9, 0x78, 0x73, 0x64,
+  0xea, 0xc5, 0xac, 0x83, 0x34, 0xd3, 0xeb, 0xc3, 0xc5, 0x81, 0xa0, 0xff, 0xfa, 0x13, 0x63, 0xeb,
+  0x17, 0x0d, 0xdd, 0x51, 0xb7, 0xf0, 0xda, 0x49, 0xd3, 0x16, 0x55, 0x26, 0x29, 0xd4, 0x68, 0x9e,
+  0x2b, 0x16, 0xbe, 0x58, 0x7d, 0x47, 0xa1, 0xfc, 0x8f, 0xf8, 0xb8, 0xd1, 0x7a, 0xd0, 0x31, 0xce,
+  0x45, 0xcb, 0x3a, 0x8f, 0x95, 0x16, 0x04, 0x28, 0xaf, 0xd7, 0xfb, 0xca, 0xbb, 0x4b, 0x40, 0x7e,
+};
+
+inline uint32_t
+read_le32 (const uint8_t *p)
+{
+  return static_cast<uint32_t> (p[0]) | static_cast<uint32_t> (p[1]) << 8
+         | static_cast<uint32_t> (p[2]) << 16 | static_cast<uint32_t> (p[3]) << 24;
+}
+
+inline uint64_t
+read_le64 (const uint8_t *p)
+{
+  return static_cast<uint64_t> (read_le32 (p))
+         | static_cast<uint64_t> (read_le32 (p + 4)) << 32;
+}
+
+inline uint64_t rotl64 (uint64_t x, int s) { return (x << s) | (x >> (64 - s)); }
+
+inline uint64_t
+swap64 (uint64_t x)
+{
+  return __builtin_bswap64 (x);
+}
+
+inline uint64_t
+mul128_fold64 (uint64_t lhs, uint64_t rhs)
+{
+  const unsigned __int128 product = static_cast<unsigned __int128> (lhs) * rhs;
+  return static_cast<uint64_t> (product) ^ static_cast<uint64_t> (product >> 64);
+}
+
+inline uint64_t
+xxh64_avalanche (uint64_t h)
+{
+  h ^= h >> 33;
+  h *= PRIME64_2;
+  h ^= h >> 29;
+  h *= PRIME64_3;
+  h ^= h >> 32;
+  return h;
+}
+
+inline uint64_t
+avalanche (uint64_t h)
+{
+  h ^= h >> 37;
+  h *= PRIME_MX1;
+  h ^= h >> 32;
+  return h;
+}
+
+inline uint64_t
+rrmxmx (uint64_t h, uint64_t len)
+{
+  h ^= rotl64 (h, 49) ^ rotl64 (h, 24);
+  h *= PRIME_MX2;
+  h ^= (h >> 35) + len;
+  h *= PRIME_MX2;
+  return h ^ (h >> 28);
+}
+
+inline uint64_t
+mix16 (const uint8_t *input, const uint8_t *secret)
+{
+  return mul128_fold64 (read_le64 (input) ^ read_le64 (secret),
+                        read_le64 (input + 8) ^ read_le64 (secret + 8));
+}
+
+uint64_t
+hash_0to16 (const uint8_t *input, size_t len)
+{
+  if (len > 8)
+    {
+      const uint64_t bitflip1 = read_le64 (SECRET + 24) ^ read_le64 (SECRET + 32);
+      const uint64_t bitflip2 = read_le64 (SECRET + 40) ^ read_le64 (SECRET + 48);
+      const uint64_t lo = read_le64 (input) ^ bitflip1;
+      const uint64_t hi = read_le64 (input + len - 8) ^ bitflip2;
+      return avalanche (len + swap64 (lo) + hi + mul128_fold64 (lo, hi));
+    }
+  if (len >= 4)
+    {
+      const uint32_t in1 = read_le32 (input);
+      const uint32_t in2 = read_le32 (input + len - 4);
+      const uint64_t bitflip = read_le64 (SECRET + 8) ^ read_le64 (SECRET + 16);
+      const uint64_t in64 = in2 + (static_cast<uint64_t> (in1) << 32);
+      return rrmxmx (in64 ^ bitflip, len);
+    }
+  if (len > 0)
+    {
+      const uint32_t c1 = input[0];
+      const uint32_t c2 = input[len >> 1];
+      const uint32_t c3 = input[len - 1];
+      const uint32_t combined = (c1 << 16) | (c2 << 24) | c3
+                                | (static_cast<uint32_t> (len) << 8);
+      const uint64_t bitflip = read_le32 (SECRET) ^ read_le32 (SECRET + 4);
+      return xxh64_avalanche (combined ^ bitflip);
+    }
+  return xxh64_avalanche (read_le64 (SECRET + 56) ^ read_le64 (SECRET + 64));
+}
+
+uint64_t
+hash_17to128 (const uint8_t *input, size_t len)
+{
+  uint64_t acc = len * PRIME64_1;
+  if (len > 32)
+    {
+      if (len > 64)
+        {
+          if (len > 96)
+            {
+              acc += mix16 (input + 48, SECRET + 96);
+              acc += mix16 (input + len - 64, SECRET + 112);
+            }
+          acc += mix16 (input + 32, SECRET + 64);
+          acc += mix16 (input + len - 48, SECRET + 80);
+        }
+      acc += mix16 (input + 16, SECRET + 32);
+      acc += mix16 (input + len - 32, SECRET + 48);
+    }
+  acc += mix16 (input, SECRET);
+  acc += mix16 (input + len - 16, SECRET + 16);
+  return avalanche (acc);
+}
+
+uint64_t
+hash_129to240 (const uint8_t *input, size_t len)
+{
+  uint64_t acc = len * PRIME64_1;
+  const size_t rounds = len / 16;
+  for (size_t i = 0; i < 8; ++i)
+    {
+      acc += mix16 (input + 16 * i, SECRET + 16 * i);
+    }
+  acc = avalanche (acc);
+  for (size_t i = 8; i < rounds; ++i)
+    {
+      acc += mix16 (input + 16 * i, SECRET + 16 * (i - 8) + MIDSIZE_START_OFFSET);
+    }
+  acc += mix16 (input + len - 16, SECRET + SECRET_SIZE_MIN - MIDSIZE_LAST_OFFSET);
+  return avalanche (acc);
+}
+
+inline void
+accumulate_512 (uint64_t acc[8], const uint8_t *input, const uint8_t *secret)
+{
+  for (int i = 0; i < 8; ++i)
+    {
+      const uint64_t data = read_le64 (input + 8 * i);
+      const uint64_t key = data ^ read_le64 (secret + 8 * i);
+      acc[i ^ 1] += data;
+      acc[i] += (key & 0xffffffffULL) * (key >> 32);
+    }
+}
+
+inline void
+scramble (uint64_t acc[8], const uint8_t *secret)
+{
+  for (int i = 0; i < 8; ++i)
+    {
+      uint64_t a = acc[i];
+      a ^= a >> 47;
+      a ^= read_le64 (secret + 8 * i);
+      a *= PRIME32_1;
+      acc[i] = a;
+    }
+}
+
+uint64_t
+merge_accs (const uint64_t acc[8], const uint8_t *secret, uint64_t start)
+{
+  uint64_t result = start;
+  for (int i = 0; i < 4; ++i)
+    {
+      result += mul128_fold64 (acc[2 * i] ^ read_le64 (secret + 16 * i),
+                               acc[2 * i + 1] ^ read_le64 (secret + 16 * i + 8));
+    }
+  return avalanche (result);
+}
+
+} // namespace
+
+void
+xxh3_context::reset ()
+{
+  const uint64_t init[8] = { PRIME32_3, PRIME64_1, PRIME64_2, PRIME64_3,
+                             PRIME64_4, PRIME32_2, PRIME64_5, PRIME32_1 };
+  std::memcpy (acc_, init, sizeof (acc_));
+  buffered_ = 0;
+  stripes_in_block_ = 0;
+  total_len_ = 0;
+}
+
+void
+xxh3_context::consume_stripes (uint64_t acc[8], const uint8_t *input,
+                               size_t stripes, size_t &stripes_in_block) const
+{
+  for (size_t n = 0; n < stripes; ++n)
+    {
+      accumulate_512 (acc, input + n * STRIPE_LEN, SECRET + stripes_in_block * 8);
+      if (++stripes_in_block == STRIPES_PER_BLOCK)
+        {
+          scramble (acc, SECRET + SECRET_SIZE - STRIPE_LEN);
+          stripes_in_block = 0;
+        }
+    }
+}
+
+void
+xxh3_context::update (const void *data, size_t size)
+{
+  const auto *input = static_cast<const uint8_t *> (data);
+  total_len_ += size;
+
+  if (buffered_ + size <= BUFFER_SIZE)
+    {
+      std::memcpy (buffer_ + buffered_, input, size);
+      buffered_ += size;
+      return;
+    }
+
+  // stripes are only consumed while more input follows them:
+  // the last stripe of the message is handled by value()
+  const size_t stripes = BUFFER_SIZE / STRIPE_LEN;
+  if (buffered_ > 0)
+    {
+      const size_t fill = BUFFER_SIZE - buffered_;
+      std::memcpy (buffer_ + buffered_, input, fill);
+      input += fill;
+      size -= fill;
+      consume_stripes (acc_, buffer_, stripes, stripes_in_block_);
+      std::memcpy (last_stripe_, buffer_ + BUFFER_SIZE - STRIPE_LEN, STRIPE_LEN);
+      buffered_ = 0;
+    }
+
+  for (; size > BUFFER_SIZE; input += BUFFER_SIZE, size -= BUFFER_SIZE)
+    {
+      consume_stripes (acc_, input, stripes, stripes_in_block_);
+      std::memcpy (last_stripe_, input + BUFFER_SIZE - STRIPE_LEN, STRIPE_LEN);
+    }
+
+  std::memcpy (buffer_, input, size);
+  buffered_ = size;
+}
+
+uint64_t
+xxh3_context::value () const
+{
+  // short inputs never leave the buffer
+  if (total_len_ <= 16)
+    return hash_0to16 (buffer_, total_len_);
+  if (total_len_ <= 128)
+    return hash_17to128 (buffer_, total_len_);
+  if (total_len_ <= MIDSIZE_MAX)
+    return hash_129to240 (buffer_, total_len_);
+
+  uint64_t acc[8];
+  std::memcpy (acc, acc_, sizeof (acc));
+  size_t stripes_in_block = stripes_in_block_;
+
+  const uint8_t *last;
+  uint8_t tail[STRIPE_LEN];
+  if (buffered_ >= STRIPE_LEN)
+    {
+      consume_stripes (acc, buffer_, (buffered_ - 1) / STRIPE_LEN, stripes_in_block);
+      last = buffer_ + buffered_ - STRIPE_LEN;
+    }
+  else
+    {
+      // the last stripe straddles the previous consumed stripe and the buffer
+      const size_t catchup = STRIPE_LEN - buffered_;
+      std::memcpy (tail, last_stripe_ + STRIPE_LEN - catchup, catchup);
+      std::memcpy (tail + catchup, buffer_, buffered_);
+      last = tail;
+    }
+  accumulate_512 (acc, last, SECRET + SECRET_SIZE - STRIPE_LEN - SECRET_LASTACC_START);
+
+  return merge_accs (acc, SECRET + SECRET_MERGEACCS_START, total_len_ * PRIME64_1);
+}
+
+xxh3_digest
+xxh3_context::final ()
+{
+  const uint64_t hash = value ();
+  xxh3_digest digest;
+  for (int i = 0; i < 8; ++i)
+    {
+      digest[i] = static_cast<uint8_t> (hash >> (56 - 8 * i));
+    }
+  reset ();
+  return digest;
+}
+
+} // namespace utils
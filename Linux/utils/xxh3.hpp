@@ -0,0 +1,44 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+namespace utils
+{
+
+// canonical (big-endian) form, as printed by xxhsum
+using xxh3_digest = std::array<uint8_t, 8>;
+
+/*
+ * Streaming XXH3-64 (seed 0, default secret). Not cryptographic: meant
+ * for dedup and change detection, at memory bandwidth.
+ */
+class xxh3_context
+{
+public:
+  xxh3_context () { reset (); }
+
+  void reset ();
+  void update (const void *data, size_t size);
+  uint64_t value () const;
+  xxh3_digest final ();
+
+private:
+  static constexpr size_t STRIPE_LEN = 64;
+  static constexpr size_t BUFFER_SIZE = 256;
+
+  void consume_stripes (uint64_t acc[8], const uint8_t *input, size_t stripes,
+                        size_t &stripes_in_block) const;
+
+private:
+  uint64_t acc_[8];
+  uint8_t buffer_[BUFFER_SIZE];
+  size_t buffered_;
+  // last stripe consumed out of the buffer, for short tails
+  uint8_t last_stripe_[STRIPE_LEN];
+  size_t stripes_in_block_;
+  uint64_t total_len_;
+};
+
+} // namespace utils